@@ -1,30 +1,143 @@
+#include <cstring>
 #include <iostream>
-#include <ranges>
+#include <string_view>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 using namespace std;
 
-int main(int arvc, char *argv[]) {
-  using namespace std::views;
-  using namespace std::ranges;
-
-  auto solution = 0;
-  constexpr auto digits = [](char ch){ return isdigit(ch); };
-  constexpr auto first = []() { return take(1); };
-  constexpr auto last = [](auto it){ return drop(it.size() - 1); };
-  string num;
-  num.reserve(2);
-
-  for (string line; getline(cin, line);) {
-    num.clear();
-    auto ds = line | filter(digits) | to<string>();
-    num += ds | first() | to<string>();
-    num += ds | last(ds) | to<string>();
-    if (!num.empty()) {
-      solution += stoi(num);
+/// Input bytes, mapped when stdin (or the file argument) is a regular file
+/// and read into a buffer otherwise (pipes, terminals).
+class input_buffer {
+  const char *m_data = nullptr;
+  size_t m_size = 0;
+  bool m_mapped = false;
+  vector<char> m_buffer;
+
+public:
+  explicit input_buffer(int fd) {
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+      void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p != MAP_FAILED) {
+        madvise(p, st.st_size, MADV_SEQUENTIAL);
+        m_data = static_cast<const char *>(p);
+        m_size = st.st_size;
+        m_mapped = true;
+        return;
+      }
+    }
+
+    char chunk[1 << 16];
+    for (ssize_t n; (n = read(fd, chunk, sizeof chunk)) > 0;) {
+      m_buffer.insert(m_buffer.end(), chunk, chunk + n);
+    }
+    m_data = m_buffer.data();
+    m_size = m_buffer.size();
+  }
+
+  ~input_buffer() {
+    if (m_mapped) {
+      munmap(const_cast<char *>(m_data), m_size);
     }
-    cout << endl << "digits: " << num;
   }
 
-  cout << endl << "Solution: " << solution << endl;
+  input_buffer(const input_buffer &) = delete;
+  input_buffer &operator=(const input_buffer &) = delete;
+
+  string_view view() const { return {m_data, m_size}; }
+};
+
+/// Spelled-out digits, indexed by value
+constexpr string_view words[] = {
+  "", "one", "two", "three", "four", "five", "six", "seven", "eight", "nine",
+};
+
+/// Returns the digit starting at line[i], or -1. When `spelled` is set,
+/// "one".."nine" count as digits too. The first letter picks the (at most
+/// three) candidate words, so this is the first level of a trie over
+/// `words` and a single compare for the remaining letters.
+constexpr int digit_at(string_view line, size_t i, bool spelled) {
+  const char ch = line[i];
+  if ('0' <= ch && ch <= '9') {
+    return ch - '0';
+  }
+  if (!spelled) {
+    return -1;
+  }
+
+  auto rest = line.substr(i);
+  auto match = [&](int d) { return rest.starts_with(words[d]); };
+  switch (ch) {
+  case 'o':
+    return match(1) ? 1 : -1;
+  case 't':
+    return match(2) ? 2 : match(3) ? 3 : -1;
+  case 'f':
+    return match(4) ? 4 : match(5) ? 5 : -1;
+  case 's':
+    return match(6) ? 6 : match(7) ? 7 : -1;
+  case 'e':
+    return match(8) ? 8 : -1;
+  case 'n':
+    return match(9) ? 9 : -1;
+  default:
+    return -1;
+  }
+}
+
+/// Calibration value of a line: the first and last digit as a two digit
+/// number. Scans from the front until the first digit and from the back
+/// until the last one, so the middle of the line is never touched.
+constexpr int calibration(string_view line, bool spelled) {
+  int first = -1, last = -1;
+  size_t i = 0;
+  for (; i < line.size() && first < 0; ++i) {
+    first = digit_at(line, i, spelled);
+  }
+  if (first < 0) {
+    return 0;
+  }
+  for (size_t j = line.size(); j-- >= i && last < 0;) {
+    last = digit_at(line, j, spelled);
+  }
+  return first * 10 + (last < 0 ? first : last);
+}
+
+static_assert(calibration("1abc2", false) == 12);
+static_assert(calibration("treb7uchet", false) == 77);
+static_assert(calibration("two1nine", true) == 29);
+static_assert(calibration("eightwothree", true) == 83);
+static_assert(calibration("zoneight234", true) == 14);
+static_assert(calibration("7pqrstsixteen", true) == 76);
+static_assert(calibration("oneight", true) == 18);
+static_assert(calibration("abc", true) == 0);
+
+int main(int arvc, char *argv[]) {
+  int fd = arvc > 1 ? open(argv[1], O_RDONLY) : STDIN_FILENO;
+  if (fd < 0) {
+    cerr << "Error: Could not open the file!" << endl;
+    return 1;
+  }
+
+  input_buffer input(fd);
+  auto text = input.view();
+
+  long solution = 0, solution2 = 0;
+  while (!text.empty()) {
+    auto eol = text.find('\n');
+    auto line = text.substr(0, eol);
+    text.remove_prefix(eol == string_view::npos ? text.size() : eol + 1);
+
+    solution += calibration(line, false);
+    solution2 += calibration(line, true);
+  }
+
+  cout << "Solution: " << solution << '\n';
+  cout << "Solution 2: " << solution2 << endl;
   return 0;
 }
@@ -1,54 +1,17 @@
-#include <cstdio>
+#include <array>
+#include <charconv>
 #include <iostream>
-#include <sstream>
-#include <stdexcept>
+#include <optional>
+#include <string_view>
 #include <utility>
 
 using namespace std;
 
 
-/// Reads a literal from a istream with >> operator
-class lit {
-  const string s;
-
-public:
-  lit(string s) : s(s) {}
-
-  friend istream &operator>>(istream &in, const lit &l) {
-    string token;
-    token.reserve(l.s.size());
-    in >> token;
-    if (in.good() && token != l.s) {
-      in.setstate(ios_base::failbit);
-    }
-
-    return in;
-  }
-};
-
-
 enum class Color {
   Green, Red, Blue,
 };
 
-istream& operator>>(istream &in, Color &c)
-{
-  string colorStr;
-  colorStr.reserve(5);
-  in >> colorStr;
-  if (colorStr == "red") {
-    *c = Color::Red;
-  } else if (colorStr == "green") {
-    c = Color::Green;
-  } else if (colorStr == "blue") {
-    c = Color::Blue;
-  } else {
-    in.setstate(ios_base::failbit);
-  }
-
-  return in;
-};
-
 ostream& operator<<(ostream &out, const Color &c)
 {
   switch (c) {
@@ -67,25 +30,128 @@ ostream& operator<<(ostream &out, const Color &c)
   return out;
 }
 
-int main(int arvc, char *argv[]) {
-  auto err = invalid_argument("Bad input");
+/// Largest number of cubes of each color seen in a game, indexed by Color
+using cubes = array<int, 3>;
 
-  for (string line; getline(cin, line);) {
-    istringstream tokens(line);
-    int game{}, num{};
-    Color color{};
+struct game {
+  int id;
+  cubes max;
+};
 
-    tokens >> lit("Game") >> game >> lit(":");
-    if (tokens.fail()) {
-      continue;
+/// Cursor over a line, every method consumes input only on success
+class scanner {
+  string_view s;
+
+public:
+  scanner(string_view s) : s(s) {}
+
+  bool done() const { return s.empty(); }
+
+  void skip_spaces() {
+    while (!s.empty() && s.front() == ' ') {
+      s.remove_prefix(1);
+    }
+  }
+
+  bool lit(string_view l) {
+    skip_spaces();
+    if (!s.starts_with(l)) {
+      return false;
+    }
+    s.remove_prefix(l.size());
+    return true;
+  }
+
+  optional<int> number() {
+    skip_spaces();
+    int n{};
+    auto [ptr, ec] = from_chars(s.data(), s.data() + s.size(), n);
+    if (ec != errc()) {
+      return nullopt;
     }
+    s.remove_prefix(ptr - s.data());
+    return n;
+  }
+
+  optional<Color> color() {
+    if (lit("red")) {
+      return Color::Red;
+    } else if (lit("green")) {
+      return Color::Green;
+    } else if (lit("blue")) {
+      return Color::Blue;
+    }
+    return nullopt;
+  }
+};
 
+/// Parses `Game N: a color, b color; c color ...` in a single pass, keeping
+/// only the per-color maximum across all draws
+optional<game> parse_game(string_view line) {
+  scanner in(line);
+  game g{};
 
-    tokens >> num >> color;
+  auto id = in.lit("Game") ? in.number() : nullopt;
+  if (!id || !in.lit(":")) {
+    return nullopt;
+  }
+  g.id = *id;
+
+  do {
+    auto num = in.number();
+    auto color = num ? in.color() : nullopt;
+    if (!color) {
+      return nullopt;
+    }
+    auto &max = g.max[to_underlying(*color)];
+    max = std::max(max, *num);
+  } while (in.lit(",") || in.lit(";"));
+
+  in.skip_spaces();
+  if (!in.done()) {
+    return nullopt;
+  }
+  return g;
+}
 
-    cout << "Game " << game << ", Color " << num << " " << color << endl;
+/// A game is possible if the bag holds at least the maximum of every color
+constexpr bool possible(const cubes &max, const cubes &bag) {
+  for (size_t i = 0; i < max.size(); ++i) {
+    if (max[i] > bag[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+constexpr long power(const cubes &max) {
+  return long(max[0]) * max[1] * max[2];
+}
+
+int main(int arvc, char *argv[]) {
+  constexpr cubes bag = [] {
+    cubes c{};
+    c[to_underlying(Color::Red)] = 12;
+    c[to_underlying(Color::Green)] = 13;
+    c[to_underlying(Color::Blue)] = 14;
+    return c;
+  }();
+
+  long solution = 0, solution2 = 0;
+  for (string line; getline(cin, line);) {
+    auto g = parse_game(line);
+    if (!g) {
+      continue;
+    }
+
+    if (possible(g->max, bag)) {
+      solution += g->id;
+    }
+    solution2 += power(g->max);
   }
 
+  cout << "Solution: " << solution << '\n';
+  cout << "Solution 2: " << solution2 << endl;
   return 0;
 }
 //
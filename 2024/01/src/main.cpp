@@ -3,6 +3,10 @@
 #include <fstream>
 #include <vector>
 
+#include "alloc_stats.hpp"
+#include "options.hpp"
+#include "perf_stats.hpp"
+
 
 // read the input
 // split into left and right lists
@@ -11,12 +15,15 @@
 // subtract each pair ( figure out how far apart the two numbers)
 // sum the list
 int main(int argc, char* argv[]) {
-    std::ifstream file(argv[1]);
+    const auto opts = parse_options(argc, argv);
+    perf_stats::session perf(opts.perf);
+    std::ifstream file(opts.input);
     if (!file.is_open()) {
         std::cerr << "Error: Could not open the file!" << std::endl;
         return 1;
     }
 
+    alloc_stats::phase parse("parse");
     int left, right;
     std::vector<int> leftNumbers, rightNumbers;
 
@@ -25,7 +32,9 @@ int main(int argc, char* argv[]) {
         rightNumbers.push_back(right); // Add pair to the vector
         std::cout << "Number 1: " << left << ", Number 2: " << right << std::endl;
     }
+    parse.stop();
 
+    alloc_stats::phase part1("part1");
     std::sort(leftNumbers.begin(), leftNumbers.end());
     std::sort(rightNumbers.begin(), rightNumbers.end());
     
@@ -34,6 +43,7 @@ int main(int argc, char* argv[]) {
     for (size_t i = 0; i < leftNumbers.size(); ++i) {
         output += std::abs(leftNumbers[i] - rightNumbers[i]);
     }
+    part1.stop();
     
     std::cout << output << std::endl;
     return 0;
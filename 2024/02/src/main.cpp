@@ -1,28 +1,255 @@
 #include <algorithm>
+#include <cstdint>
+#include <cstdlib>
 #include <iostream>
 #include <fstream>
+#include <memory_resource>
+#include <span>
 #include <vector>
 #include <sstream>
+#include <random>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "alloc_stats.hpp"
+#include "arena.hpp"
+#include "options.hpp"
+#include "perf_stats.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS 1
+#else
+#define HAVE_X86_KERNELS 0
+#endif
 
 
 using namespace std;
+
+// Reports packed as a structure of arrays: every report takes `width`
+// consecutive levels (padded with zeroes) in `levels` and its real length
+// lives in `lengths`. Reports longer than `width` don't fit a vector
+// register and are kept aside in `long_reports` for the scalar path.
+struct reports {
+    static constexpr size_t width = 8;
+
+    explicit reports(pmr::memory_resource* mr = pmr::get_default_resource())
+        : levels(mr), lengths(mr), long_reports(mr) {}
+
+    pmr::vector<int32_t> levels;
+    pmr::vector<uint8_t> lengths;
+    pmr::vector<pmr::vector<int>> long_reports;
+
+    size_t size() const { return lengths.size(); }
+
+    void push_back(const vector<int>& numbers) {
+        if (numbers.size() > width) {
+            long_reports.emplace_back(numbers.begin(), numbers.end());
+            return;
+        }
+        // the kernels load `width` levels starting at the second level of
+        // a report, so keep one extra zero after the last report
+        if (!levels.empty())
+            levels.pop_back();
+        levels.insert(levels.end(), numbers.begin(), numbers.end());
+        levels.resize(levels.size() + (width - numbers.size()) + 1);
+        lengths.push_back(numbers.size());
+    }
+
+    span<const int32_t> report(size_t i) const {
+        return span(levels).subspan(i * width, lengths[i]);
+    }
+};
+
+// 1. The levels are either all increasing or all decreasing.
+// 2. Any two adjacent levels differ by at least one and at most three.
+//           1 <= |a - b| <= 3
+bool safe(span<const int32_t> levels) {
+    if (!is_sorted(levels.begin(), levels.end()) && !is_sorted(levels.rbegin(), levels.rend()))
+        return false;
+
+    for (size_t i = 0; i + 1 < levels.size(); i++) {
+        const auto d = abs(levels[i] - levels[i+1]);
+        if (!(1 <= d && d <= 3))
+            return false;
+    }
+    return true;
+}
+
+bool safe(const vector<int>& levels) {
+    return safe(span<const int32_t>(levels));
+}
+
+// Bitmask with one bit set per adjacent pair of a report with `length` levels
+constexpr unsigned pairs_mask(unsigned length) {
+    return length > 1 ? (1u << (length - 1)) - 1 : 0;
+}
+
+size_t count_safe_scalar(const reports& reps) {
+    size_t output = 0;
+    for (size_t i = 0; i < reps.size(); ++i) {
+        output += safe(reps.report(i));
+    }
+    return output;
+}
+
+#if HAVE_X86_KERNELS
+// Both kernels compute d = levels[i+1] - levels[i] for all lanes at once and
+// then check whether every pair of the report is in [1, 3] (increasing) or
+// every pair is in [-3, -1] (decreasing). This is the same rule as safe():
+// a strictly monotonic report with small steps is sorted in one direction.
+__attribute__((target("sse4.1")))
+size_t count_safe_sse4(const reports& reps) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i four = _mm_set1_epi32(4);
+    const __m128i minus_four = _mm_set1_epi32(-4);
+
+    size_t output = 0;
+    const int32_t* base = reps.levels.data();
+    for (size_t i = 0; i < reps.size(); ++i, base += reports::width) {
+        unsigned inc = 0, dec = 0;
+        for (unsigned half = 0; half < 2; ++half) {
+            const auto* p = base + half * 4;
+            const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+            const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 1));
+            const __m128i d = _mm_sub_epi32(b, a);
+            const __m128i up = _mm_and_si128(_mm_cmpgt_epi32(d, zero), _mm_cmpgt_epi32(four, d));
+            const __m128i down = _mm_and_si128(_mm_cmpgt_epi32(zero, d), _mm_cmpgt_epi32(d, minus_four));
+            inc |= _mm_movemask_ps(_mm_castsi128_ps(up)) << (half * 4);
+            dec |= _mm_movemask_ps(_mm_castsi128_ps(down)) << (half * 4);
+        }
+        const auto mask = pairs_mask(reps.lengths[i]);
+        output += (inc & mask) == mask || (dec & mask) == mask;
+    }
+    return output;
+}
+
+__attribute__((target("avx2")))
+size_t count_safe_avx2(const reports& reps) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i four = _mm256_set1_epi32(4);
+    const __m256i minus_four = _mm256_set1_epi32(-4);
+
+    size_t output = 0;
+    const int32_t* base = reps.levels.data();
+    for (size_t i = 0; i < reps.size(); ++i, base += reports::width) {
+        const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(base));
+        const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(base + 1));
+        const __m256i d = _mm256_sub_epi32(b, a);
+        const __m256i up = _mm256_and_si256(_mm256_cmpgt_epi32(d, zero), _mm256_cmpgt_epi32(four, d));
+        const __m256i down = _mm256_and_si256(_mm256_cmpgt_epi32(zero, d), _mm256_cmpgt_epi32(d, minus_four));
+        const unsigned inc = _mm256_movemask_ps(_mm256_castsi256_ps(up));
+        const unsigned dec = _mm256_movemask_ps(_mm256_castsi256_ps(down));
+        const auto mask = pairs_mask(reps.lengths[i]);
+        output += (inc & mask) == mask || (dec & mask) == mask;
+    }
+    return output;
+}
+#endif
+
+using count_safe_fn = size_t (*)(const reports&);
+
+// Pick the widest kernel the running CPU supports
+count_safe_fn select_kernel() {
+#if HAVE_X86_KERNELS
+    if (__builtin_cpu_supports("avx2"))
+        return count_safe_avx2;
+    if (__builtin_cpu_supports("sse4.1"))
+        return count_safe_sse4;
+#endif
+    return count_safe_scalar;
+}
+
+// Safe reports, the packed ones through `kernel` and the long ones one by one
+size_t count_safe(const reports& reps, count_safe_fn kernel) {
+    size_t output = kernel(reps);
+    for (const auto& report : reps.long_reports) {
+        output += safe(report);
+    }
+    return output;
+}
+
+// The kernels the running CPU can execute, the scalar one first
+vector<count_safe_fn> available_kernels() {
+    vector<count_safe_fn> output = {count_safe_scalar};
+#if HAVE_X86_KERNELS
+    if (__builtin_cpu_supports("sse4.1"))
+        output.push_back(count_safe_sse4);
+    if (__builtin_cpu_supports("avx2"))
+        output.push_back(count_safe_avx2);
+#endif
+    return output;
+}
+
+TEST(KernelTest, EdgeLengths) {
+    // one report per set, so the zero padding after it is what gets loaded
+    const vector<vector<int>> cases = {
+        {5}, {1, 2}, {1, 5}, {3, 3}, {9, 8, 6, 3}, {1, 2, 3, 4, 5, 6, 7, 8}, {1, 2, 3, 4, 5, 6, 7, 11},
+        {8, 7, 6, 5, 4, 3, 2, 1}, {1, 2, 3, 4, 5, 6, 7, 8, 9}, {1, 2, 3, 4, 5, 6, 7, 8, 8},
+        {-3, -1, 0}, {0, 0}, {0, 1},
+    };
+    for (const auto& levels : cases) {
+        reports reps;
+        reps.push_back(levels);
+        for (auto kernel : available_kernels()) {
+            ASSERT_EQ(count_safe(reps, kernel), safe(levels) ? 1u : 0u) << levels.size() << " levels";
+        }
+    }
+}
+
+TEST(KernelTest, RandomReportsAgree) {
+    mt19937 rng(26);
+    for (int round = 0; round < 200; ++round) {
+        reports reps;
+        size_t expected = 0;
+        for (int r = 0, n = rng() % 50; r < n; ++r) {
+            vector<int> levels(1 + rng() % 12);
+            levels[0] = static_cast<int>(rng() % 100) - 50;
+            const int dir = rng() % 2 ? 1 : -1;
+            for (size_t i = 1; i < levels.size(); ++i) {
+                // mostly safe steps, sometimes a flat, reversed or large one
+                const int step = rng() % 8 == 0 ? static_cast<int>(rng() % 9) - 4 : dir * static_cast<int>(1 + rng() % 3);
+                levels[i] = levels[i - 1] + step;
+            }
+            expected += safe(levels);
+            reps.push_back(levels);
+        }
+        for (auto kernel : available_kernels()) {
+            ASSERT_EQ(count_safe(reps, kernel), expected) << "round " << round;
+        }
+    }
+}
+
 // read the input
 // parse the input
 // ???
 // print the output
 int main(int argc, char* argv[]) {
-    ifstream file(argv[1]);
+    const char* run_tests = getenv("RUN_GTEST");
+    if (run_tests != nullptr && string(run_tests) != "") {
+        ::testing::InitGoogleTest(&argc, argv);
+        return RUN_ALL_TESTS();
+    }
+
+    const auto opts = parse_options(argc, argv);
+    perf_stats::session perf(opts.perf);
+    ifstream file(opts.input);
     if (!file.is_open()) {
         cerr << "Error: Could not open the file!" << endl;
         return 1;
     }
 
-    vector<vector<int>> numberLines;
+    // levels take about as much room as their digits and separators
+    arena input_arena(arena::hint(opts.input, 2));
+    reports numberLines(input_arena.resource());
 
     // parse the input
+    alloc_stats::phase parse("parse");
     string line;
+    vector<int> numbers;
     while (getline(file, line)) {
-        vector<int> numbers;
+        numbers.clear();
 
         istringstream iss(line);
         int num;
@@ -31,28 +258,13 @@ int main(int argc, char* argv[]) {
         }
         numberLines.push_back(numbers);
     }
+    parse.stop();
 
-    int output = 0;
-    for (const auto& innerVec : numberLines) {
-        // 1. The levels are either all increasing or all decreasing.
-        if (!is_sorted(innerVec.begin(), innerVec.end()) && !is_sorted(innerVec.rbegin(), innerVec.rend()))
-            continue;
-
-        int bad = 0;
-        for (size_t i = 0; i + 1 < innerVec.size(); i++) {
-            // 2. Any two adjacent levels differ by at least one and at most three.
-            //           1 <= |a - b| <= 3
-            const auto d = abs(innerVec[i] - innerVec[i+1]);
-            if (!(1 <= d && d <= 3)) {
-                bad = 1;
-                break;
-            }
-        }
-        if (!bad)
-            output++;
-    }
+    alloc_stats::phase part1("part1");
+    size_t output = count_safe(numberLines, select_kernel());
+    part1.stop();
 
     // print the output
     cout << output << endl;
-    return 0; 
+    return 0;
 }
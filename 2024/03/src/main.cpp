@@ -7,6 +7,10 @@
 #include <expected>
 #include <optional>
 
+#include "alloc_stats.hpp"
+#include "options.hpp"
+#include "perf_stats.hpp"
+
 
 using namespace std;
 
@@ -136,19 +140,26 @@ int compute_output(vector<vector<pair<int, int>>> input)
 // ???
 // print the output
 int main(int argc, char* argv[]) {
-    ifstream file(argv[1]);
+    const auto opts = parse_options(argc, argv);
+    perf_stats::session perf(opts.perf);
+    ifstream file(opts.input);
     if (!file.is_open()) {
         cerr << "Error: Could not open the file!" << endl;
         return 1;
     }
 
+    alloc_stats::phase parse("parse");
     vector<vector<pair<int, int>>> parsed_result;
     Parser parser(file);
     while (auto parsed = parser.parse_line()) {
         parsed_result.push_back(parsed.value());
     }
 
+    parse.stop();
+
+    alloc_stats::phase part1("part1");
     auto output = compute_output(parsed_result);
+    part1.stop();
 
     // print the output
     cout << "Solution: " << output << endl;
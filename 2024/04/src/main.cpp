@@ -1,22 +1,50 @@
 #include <algorithm>
+#include <bit>
 #include <cassert>
 #include <cmath>
+#include <cstdint>
+#include <cstdlib>
 #include <filesystem>
-#include <functional>
 #include <iostream>
 #include <fstream>
-#include <iterator>
+#include <memory_resource>
+#include <random>
+#include <ranges>
+#include <stdexcept>
+#include <string>
+#include <string_view>
 #include <vector>
 #include <expected>
 
+#include <gtest/gtest.h>
+
+#include "alloc_stats.hpp"
+#include "arena.hpp"
+#include "options.hpp"
+#include "perf_stats.hpp"
+#include "thread_pool.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS 1
+#else
+#define HAVE_X86_KERNELS 0
+#endif
 
 using namespace std;
 
-// Parsed input type
-using input = vector<vector<char>>;
+// Parsed input type: the grid row by row in a single array
+struct input {
+    explicit input(pmr::memory_resource* mr = pmr::get_default_resource())
+        : cells(mr) {}
+
+    pmr::vector<char> cells;
+    size_t row_count = 0;
+    size_t column_count = 0;
+};
 
-// Parse the input string into nested vector
-input readinput(string path) {
+// Parse the input string into a flat grid
+input readinput(string path, pmr::memory_resource* mr) {
     ifstream file(path);
     if (!file.is_open()) {
         throw filesystem::filesystem_error(
@@ -26,115 +54,313 @@ input readinput(string path) {
     }
 
     string line;
-    vector<vector<char>> lines;
+    input grid(mr);
     while (getline(file, line)) {
-        vector<char> linevec(line.begin(), line.end());
-        lines.push_back(linevec);
+        if (grid.row_count > 0 && line.size() != grid.column_count) {
+            throw invalid_argument("Row " + to_string(grid.row_count) + " has " + to_string(line.size())
+                                   + " columns, expected " + to_string(grid.column_count));
+        }
+        grid.column_count = line.size();
+        grid.cells.insert(grid.cells.end(), line.begin(), line.end());
+        grid.row_count++;
     }
-    return lines;
+    return grid;
 }
 
-// Methods for collecting rows, columns and diagonals into vectors
+// Lazy traversals of the grid. A line is a strided view over the cells and
+// rows(), columns(), diagonals() and diagonals2() are ranges of lines, so
+// walking them copies nothing.
 struct input_wrapper : input {
-    void rows(std::function<void(vector<char>)> func)
+    // `length` cells starting at cells[first], `stride` apart
+    auto line(size_t first, size_t stride, size_t length) const
     {
-        for (auto row : *this) {
-            func(row);
-        }
+        return views::iota(size_t{0}, length)
+            | views::transform([data = cells.data(), first, stride](size_t i) {
+                return data[first + i * stride];
+            });
     }
 
-    void columns(function<void(vector<char>)> func)
+    auto rows() const
     {
-        assert(!this->empty() && "Container is empty");
-        auto column_max = (*this)[0].size();
-        for (size_t c = 0; c < column_max; c++) {
-            vector<char> column;
-            for (auto lines : *this) {
-                if (c < lines.size()) {
-                    column.push_back(lines[c]);
-                }
-            }
-            func(column);
-        }
+        return views::iota(size_t{0}, row_count)
+            | views::transform([this](size_t r) {
+                return line(r * column_count, 1, column_count);
+            });
     }
 
-    void diagonals(function<void(vector<char>)> func)
+    auto columns() const
     {
-        const int rows = size();
-        assert(size() > 0);
-        const int columns = (*this)[0].size();
-        assert(rows >= columns);
-
-        for (int d = 0 - (columns - 1); d <= (columns - 1); d++) {
-            vector<char> diagonals;
-            for (int x = 0, y = 0; x < rows; x++, y++) {
-                auto xd = x + d;
-                if (0 <= xd && xd < rows && y < columns) {
-                    assert(size() > xd && (*this)[xd].size() > y);
-                    diagonals.push_back((*this)[xd][y]);
-                }
-            }   
-            func(diagonals);
-        }
+        return views::iota(size_t{0}, column_count)
+            | views::transform([this](size_t c) {
+                return line(c, column_count, row_count);
+            });
     }
 
-    void diagonals2(function<void(vector<char>)> func)
+    // Down and to the right, one line per row - column difference
+    auto diagonals() const
     {
-        const int rows = size();
-        assert(size() > 0);
-        const int columns = (*this)[0].size();
-        assert(rows >= columns);
-
-        for (int d = 0 - (columns - 1); d <= (columns - 1); d++) {
-            vector<char> diagonals;
-            for (int x = 0, y = columns - 1; x < rows; x++, y--) {
-                auto xd = x + d;
-                if (0 <= xd && xd < rows && y < columns) {
-                    assert(size() > xd && (*this)[xd].size() > y);
-                    diagonals.push_back((*this)[xd][y]);
-                }
-                if (y == 0) {
-                    y = columns - 1;
-                }
-            }
-            func(diagonals);
-        }
+        return views::iota(size_t{0}, diagonal_count())
+            | views::transform([this](size_t k) {
+                // k = row - column + columns - 1
+                const size_t r = k < column_count ? 0 : k - (column_count - 1);
+                const size_t c = k < column_count ? column_count - 1 - k : 0;
+                return line(r * column_count + c, column_count + 1,
+                            min(row_count - r, column_count - c));
+            });
+    }
+
+    // Down and to the left, one line per row + column sum
+    auto diagonals2() const
+    {
+        return views::iota(size_t{0}, diagonal_count())
+            | views::transform([this](size_t k) {
+                // k = row + column
+                const size_t r = k < column_count ? 0 : k - (column_count - 1);
+                const size_t c = k - r;
+                return line(r * column_count + c, column_count - 1,
+                            min(row_count - r, c + 1));
+            });
+    }
+
+private:
+    size_t diagonal_count() const
+    {
+        return row_count == 0 || column_count == 0 ? 0 : row_count + column_count - 1;
     }
 };
 
-struct vecwrapper : vector<char> {
-    // count number of xmas and samx in a vector
-    unsigned count_xmas() {
-        string temp;
-        copy(begin(), end(), back_inserter(temp));
-
-        int count = 0;
-        for (size_t offset = 0; offset < temp.size(); offset++) {
-            string_view temp_view = string_view{temp}.substr(offset);
-            if (temp_view.starts_with("XMAS"))
-                count++;
-            if (temp_view.starts_with("SAMX"))
-                count++;
+// count number of xmas and samx in a line. The last four characters are
+// kept in a shift register, so the line is read once and never buffered.
+unsigned count_xmas(ranges::sized_range auto&& line) {
+    constexpr auto pack = [](string_view word) {
+        uint32_t w = 0;
+        for (char ch : word)
+            w = (w << 8) | static_cast<uint8_t>(ch);
+        return w;
+    };
+    constexpr uint32_t xmas = pack("XMAS");
+    constexpr uint32_t samx = pack("SAMX");
+
+    if (ranges::size(line) < 4)
+        return 0;
+
+    unsigned count = 0;
+    uint32_t window = 0;
+    size_t seen = 0;
+    for (char ch : line) {
+        window = (window << 8) | static_cast<uint8_t>(ch);
+        if (++seen >= 4 && (window == xmas || window == samx))
+            count++;
+    }
+    return count;
+}
+
+// An X-MAS is an 'A' whose two diagonal neighbour pairs are each an 'M' and
+// an 'S', so both diagonals of its 3x3 window read MAS or SAM. The kernels
+// look at one centre row at a time with the rows above and below it, and
+// test columns [1, columns - 1).
+constexpr bool mas_ends(char a, char b) {
+    return (a == 'M' && b == 'S') || (a == 'S' && b == 'M');
+}
+
+unsigned count_x_mas_scalar(const char* above, const char* centre, const char* below,
+                            size_t first, size_t last) {
+    unsigned count = 0;
+    for (size_t c = first; c < last; ++c) {
+        count += centre[c] == 'A'
+            && mas_ends(above[c - 1], below[c + 1])
+            && mas_ends(above[c + 1], below[c - 1]);
+    }
+    return count;
+}
+
+unsigned count_x_mas_row_scalar(const char* above, const char* centre, const char* below,
+                                size_t columns) {
+    return count_x_mas_scalar(above, centre, below, 1, columns - 1);
+}
+
+#if HAVE_X86_KERNELS
+__attribute__((target("avx2")))
+inline __m256i load32(const char* p) {
+    return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+}
+
+// Lanes where x and y are an 'M' and an 'S' in either order
+__attribute__((target("avx2")))
+inline __m256i mas_ends(__m256i x, __m256i y) {
+    const __m256i m = _mm256_set1_epi8('M');
+    const __m256i s = _mm256_set1_epi8('S');
+    return _mm256_or_si256(
+        _mm256_and_si256(_mm256_cmpeq_epi8(x, m), _mm256_cmpeq_epi8(y, s)),
+        _mm256_and_si256(_mm256_cmpeq_epi8(x, s), _mm256_cmpeq_epi8(y, m)));
+}
+
+// 32 centres per step: the 'A's come from a byte compare of the centre row
+// and the four corners from the same row loads shifted one column left and
+// right, so every window is checked without gathering.
+__attribute__((target("avx2")))
+unsigned count_x_mas_row_avx2(const char* above, const char* centre, const char* below,
+                              size_t columns) {
+    const __m256i a = _mm256_set1_epi8('A');
+    unsigned count = 0;
+    size_t c = 1;
+    // the right corners of the last centre are at c + 32 < columns
+    for (; c + 33 <= columns; c += 32) {
+        const __m256i hit = _mm256_and_si256(
+            _mm256_cmpeq_epi8(load32(centre + c), a),
+            _mm256_and_si256(mas_ends(load32(above + c - 1), load32(below + c + 1)),
+                             mas_ends(load32(above + c + 1), load32(below + c - 1))));
+        count += popcount(static_cast<uint32_t>(_mm256_movemask_epi8(hit)));
+    }
+    return count + count_x_mas_scalar(above, centre, below, c, columns - 1);
+}
+#endif
+
+using x_mas_row_fn = unsigned (*)(const char*, const char*, const char*, size_t);
+
+// Pick the widest kernel the running CPU supports
+x_mas_row_fn select_x_mas_kernel() {
+#if HAVE_X86_KERNELS
+    if (__builtin_cpu_supports("avx2"))
+        return count_x_mas_row_avx2;
+#endif
+    return count_x_mas_row_scalar;
+}
+
+TEST(KernelTest, XMasRowsAgree) {
+#if HAVE_X86_KERNELS
+    if (!__builtin_cpu_supports("avx2"))
+        GTEST_SKIP() << "no AVX2";
+    mt19937 rng(46);
+    for (size_t columns = 3; columns <= 100; ++columns) {
+        for (int round = 0; round < 20; ++round) {
+            // rows of exactly `columns` cells, so a load past the end would show
+            string rows[3];
+            for (auto& row : rows) {
+                row.resize(columns);
+                for (auto& cell : row)
+                    cell = "MMSSAAX."[rng() % 8];
+            }
+            const auto data = [&](size_t i) { return rows[i].data(); };
+            ASSERT_EQ(count_x_mas_row_avx2(data(0), data(1), data(2), columns),
+                      count_x_mas_row_scalar(data(0), data(1), data(2), columns))
+                << rows[0] << '\n' << rows[1] << '\n' << rows[2];
         }
+    }
+#else
+    GTEST_SKIP() << "no x86 kernels";
+#endif
+}
 
-        return count;
+// X-MAS centred on rows [first_row, last_row), reading one row above and
+// below. One pass down the grid, three rows at a time.
+unsigned count_x_mas(const input& grid, size_t first_row, size_t last_row) {
+    if (grid.row_count < 3 || grid.column_count < 3)
+        return 0;
+
+    const auto kernel = select_x_mas_kernel();
+    const char* cells = grid.cells.data();
+    const size_t columns = grid.column_count;
+    unsigned count = 0;
+    for (size_t r = max<size_t>(first_row, 1); r < min(last_row, grid.row_count - 1); ++r) {
+        const char* centre = cells + r * columns;
+        count += kernel(centre - columns, centre, centre + columns, columns);
     }
-};
+    return count;
+}
+
+// XMAS and SAMX starting on rows [first_row, last_row), reading up to three
+// rows below. Every word is counted from its top cell (its left cell when
+// horizontal), going right, down, down-right or down-left, so splitting the
+// rows in bands counts each word exactly once.
+unsigned count_xmas(const input& grid, size_t first_row, size_t last_row) {
+    const auto rows = static_cast<ptrdiff_t>(grid.row_count);
+    const auto columns = static_cast<ptrdiff_t>(grid.column_count);
+    const char* cells = grid.cells.data();
+    constexpr ptrdiff_t directions[][2] = {{0, 1}, {1, 0}, {1, 1}, {1, -1}};
+
+    unsigned count = 0;
+    for (auto r = static_cast<ptrdiff_t>(first_row); r < static_cast<ptrdiff_t>(last_row); ++r) {
+        for (ptrdiff_t c = 0; c < columns; ++c) {
+            const char first = cells[r * columns + c];
+            if (first != 'X' && first != 'S')
+                continue;
+            const char* word = first == 'X' ? "XMAS" : "SAMX";
+            for (auto [dr, dc] : directions) {
+                const auto end_r = r + 3 * dr;
+                const auto end_c = c + 3 * dc;
+                if (end_r >= rows || end_c < 0 || end_c >= columns)
+                    continue;
+                bool match = true;
+                for (ptrdiff_t i = 1; i < 4 && match; ++i)
+                    match = cells[(r + i * dr) * columns + c + i * dc] == word[i];
+                count += match;
+            }
+        }
+    }
+    return count;
+}
+
+// count(first_row, last_row) summed over horizontal bands of the grid, one
+// task per band with its own counter
+unsigned count_bands(thread_pool& pool, const input& grid, auto&& count) {
+    const size_t bands = min<size_t>(grid.row_count, pool.size() * 4);
+    if (bands == 0)
+        return 0;
+    const size_t height = (grid.row_count + bands - 1) / bands;
+    return parallel_reduce(pool, 0, bands, 0u,
+        [&](size_t band) {
+            const size_t first = band * height;
+            return first < grid.row_count ? count(first, min(grid.row_count, first + height)) : 0u;
+        },
+        plus<>(), 1);
+}
 
 int main(int argc, char* argv[]) {
-    input_wrapper inp = input_wrapper{readinput(argv[1])};
-    int output = 0;
-    auto accumulate = [&output](vector<char> vec) {
-        output += vecwrapper{vec}.count_xmas();
+    const char* run_tests = getenv("RUN_GTEST");
+    if (run_tests != nullptr && string(run_tests) != "") {
+        ::testing::InitGoogleTest(&argc, argv);
+        return RUN_ALL_TESTS();
+    }
+
+    const auto opts = parse_options(argc, argv);
+    perf_stats::session perf(opts.perf);
+
+    alloc_stats::phase parse("parse");
+    arena input_arena(arena::hint(opts.input, 1));
+    input_wrapper inp = input_wrapper{readinput(opts.input, input_arena.resource())};
+    parse.stop();
+
+    thread_pool pool(opts.threads);
+    auto xmas = [&inp](size_t first, size_t last) { return count_xmas(inp, first, last); };
+    auto x_mas = [&inp](size_t first, size_t last) { return count_x_mas(inp, first, last); };
+
+    alloc_stats::phase part1("part1");
+    unsigned output = 0;
+    auto accumulate = [&output](auto&& lines) {
+        for (auto line : lines) {
+            output += count_xmas(line);
+        }
     };
 
-    // collect the vector in multiple directions and count
-    // the XMAS and SAMX occurrences
-    inp.rows(accumulate);
-    inp.columns(accumulate);
-    inp.diagonals(accumulate);
-    inp.diagonals2(accumulate);
+    // walk the lines in multiple directions and count
+    // the XMAS and SAMX occurrences, or scan row bands
+    // in parallel when there are threads to spare
+    if (pool.size() > 1) {
+        output = count_bands(pool, inp, xmas);
+    } else {
+        accumulate(inp.rows());
+        accumulate(inp.columns());
+        accumulate(inp.diagonals());
+        accumulate(inp.diagonals2());
+    }
+    part1.stop();
+
+    alloc_stats::phase part2("part2");
+    const auto output2 = count_bands(pool, inp, x_mas);
+    part2.stop();
 
     cout << "Output: " << output << endl;
+    cout << "Output 2: " << output2 << endl;
     return 0; 
 }
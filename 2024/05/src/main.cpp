@@ -1,24 +1,235 @@
+#include <algorithm>
+#include <bit>
 #include <cassert>
+#include <charconv>
 #include <cmath>
+#include <cstdint>
 #include <filesystem>
+#include <functional>
 #include <iostream>
-#include <ranges>
+#include <memory_resource>
+#include <span>
 #include <stdexcept>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <expected>
 #include <fstream>
 
+#include <gtest/gtest.h>
+
+#include "alloc_stats.hpp"
+#include "arena.hpp"
+#include "bitboard.hpp"
+#include "options.hpp"
+#include "perf_stats.hpp"
+#include "snapshot.hpp"
+#include "thread_pool.hpp"
+
 
 using namespace std;
 
 using rule = pair<int, int>;
-using update = vector<int>;
+using update = span<const int>;
+
+// Ordering rules indexed by page. Pages are numbered densely in the order
+// of their page numbers, so memory follows the number of distinct pages in
+// the rules and not the highest one. successors(p) lists, sorted, the pages
+// that must be printed after p (CSR over the dense indices), and
+// precedes(a, b) looks a single rule up in a bitmatrix over the indices.
+// Pages are mapped to indices through a direct table while page numbers
+// stay within lookup_slack of the page count, by binary search otherwise.
+class rule_index {
+public:
+    static constexpr size_t npos = static_cast<size_t>(-1);
+    static constexpr size_t lookup_slack = 1 << 16;
+
+    explicit rule_index(pmr::memory_resource* mr = pmr::get_default_resource())
+        : m_pages(mr), m_lookup(mr), m_offsets(1, 0, mr), m_successors(mr) {}
+
+    rule_index(span<const rule> rules, pmr::memory_resource* mr)
+        : rule_index(mr)
+    {
+        for (auto [before, after] : rules) {
+            if (before < 0 || after < 0) {
+                throw invalid_argument(format("Negative page in rule {}|{}", before, after));
+            }
+            m_pages.push_back(before);
+            m_pages.push_back(after);
+        }
+        ranges::sort(m_pages);
+        m_pages.erase(ranges::unique(m_pages).begin(), m_pages.end());
+        build_lookup();
+
+        // counting sort of the rules by their first page
+        m_offsets.assign(pages() + 1, 0);
+        for (auto [before, after] : rules) {
+            m_offsets[index(before) + 1]++;
+        }
+        for (size_t p = 0; p < pages(); ++p) {
+            m_offsets[p + 1] += m_offsets[p];
+        }
+        m_successors.resize(rules.size());
+        auto next = vector<uint32_t>(m_offsets.begin(), m_offsets.end() - 1);
+        for (auto [before, after] : rules) {
+            m_successors[next[index(before)]++] = after;
+        }
+        for (size_t p = 0; p < pages(); ++p) {
+            sort(m_successors.begin() + m_offsets[p], m_successors.begin() + m_offsets[p + 1]);
+        }
+        build_matrix();
+    }
+
+    // From the arrays of page_numbers(), offsets() and flat_successors() as
+    // stored in a snapshot
+    rule_index(span<const int> pages, span<const uint32_t> offsets, span<const int> successors,
+               pmr::memory_resource* mr)
+        : rule_index(mr)
+    {
+        m_pages.assign(pages.begin(), pages.end());
+        build_lookup();
+        m_offsets.assign(offsets.begin(), offsets.end());
+        m_successors.assign(successors.begin(), successors.end());
+        build_matrix();
+    }
+
+    // Number of distinct pages in the rules
+    size_t pages() const {
+        return m_pages.size();
+    }
+
+    size_t size() const {
+        return m_successors.size();
+    }
+
+    // Dense index of a page, npos when no rule mentions it
+    size_t index(int page) const {
+        if (!m_lookup.empty()) {
+            return page >= 0 && static_cast<size_t>(page) < m_lookup.size() ? m_lookup[page] : npos;
+        }
+        const auto it = ranges::lower_bound(m_pages, page);
+        return it != m_pages.end() && *it == page ? static_cast<size_t>(it - m_pages.begin()) : npos;
+    }
+
+    // The page with dense index i
+    int page(size_t i) const {
+        return m_pages[i];
+    }
+
+    span<const int> successors(int page) const {
+        const auto p = index(page);
+        if (p == npos) {
+            return {};
+        }
+        return span(m_successors).subspan(m_offsets[p], m_offsets[p + 1] - m_offsets[p]);
+    }
+
+    // Whether a rule says a has to be printed before b
+    bool precedes(int a, int b) const {
+        const auto i = index(a);
+        const auto j = index(b);
+        return i != npos && j != npos && m_matrix.test(i, j);
+    }
+
+    // Whether no pair of pages has rules both ways and no page one to
+    // itself
+    bool antisymmetric() const {
+        return m_antisymmetric;
+    }
+
+    // Pages in `set` (a one row bitboard over the dense indices) that `page`
+    // has to be printed before
+    size_t successors_in(int page, const bitboard& set) const {
+        const auto p = index(page);
+        if (p == npos) {
+            return 0;
+        }
+        size_t count = 0;
+        const auto row = m_matrix.row(p);
+        const auto mask = set.row(0);
+        for (size_t i = 0; i < row.size(); ++i) {
+            count += popcount(row[i] & mask[i]);
+        }
+        return count;
+    }
+
+    span<const int> page_numbers() const {
+        return m_pages;
+    }
+
+    span<const uint32_t> offsets() const {
+        return m_offsets;
+    }
+
+    span<const int> flat_successors() const {
+        return m_successors;
+    }
+
+private:
+    void build_lookup() {
+        m_lookup.clear();
+        if (m_pages.empty() || static_cast<size_t>(m_pages.back()) >= pages() + lookup_slack) {
+            return;
+        }
+        m_lookup.assign(m_pages.back() + 1, npos);
+        for (size_t i = 0; i < pages(); ++i) {
+            m_lookup[m_pages[i]] = i;
+        }
+    }
+
+    void build_matrix() {
+        m_matrix = bitboard(pages(), pages());
+        for (size_t p = 0; p < pages(); ++p) {
+            for (auto s : successors(page(p))) {
+                m_matrix.set(p, index(s));
+            }
+        }
+        m_antisymmetric = true;
+        for (size_t p = 0; p < pages(); ++p) {
+            for (auto s : successors(page(p))) {
+                m_antisymmetric = m_antisymmetric && !m_matrix.test(index(s), p);
+            }
+        }
+    }
+
+    pmr::vector<int> m_pages;
+    pmr::vector<size_t> m_lookup;
+    pmr::vector<uint32_t> m_offsets;
+    pmr::vector<int> m_successors;
+    bitboard m_matrix;
+    bool m_antisymmetric = true;
+};
+
+// All updates back to back, the pages of update i are
+// pages[offsets[i], offsets[i + 1])
+struct update_store {
+    explicit update_store(pmr::memory_resource* mr = pmr::get_default_resource())
+        : pages(mr), offsets(1, 0, mr) {}
+
+    pmr::vector<int> pages;
+    pmr::vector<uint32_t> offsets;
+
+    size_t size() const {
+        return offsets.size() - 1;
+    }
+
+    update operator[](size_t i) const {
+        return span(pages).subspan(offsets[i], offsets[i + 1] - offsets[i]);
+    }
+
+    // Closes the update made of the pages pushed since the previous one
+    void finish() {
+        offsets.push_back(pages.size());
+    }
+};
 
-// Parsed input type
+// Parsed input type, all arrays share the memory resource
 struct input {
-    vector<rule> rules;
-    vector<update> updates;
+    explicit input(pmr::memory_resource* mr = pmr::get_default_resource())
+        : rules(mr), updates(mr) {}
+
+    rule_index rules;
+    update_store updates;
 };
 
 void print_rule(const rule& rule) {
@@ -34,27 +245,28 @@ void print_update(const update& update) {
 }
 
 void print_input(const input& input) {
-    for (auto rule : input.rules) {
-        print_rule(rule);
+    for (auto page : input.rules.page_numbers()) {
+        for (auto after : input.rules.successors(page)) {
+            print_rule({page, after});
+        }
     }
 
-    for (auto update : input.updates) {
-        print_update(update);
+    for (size_t i = 0; i < input.updates.size(); ++i) {
+        print_update(input.updates[i]);
     }
 }
 
-const char* expect_string_constant(const string& input, string constant)
+string_view expect_string_constant(string_view input, string_view constant)
 {
-    string_view input_view{input};
-    auto subs = input_view.substr(0, constant.size());
+    auto subs = input.substr(0, constant.size());
     if (subs != constant) {
-        throw std::invalid_argument(format("Expected {},  {}", constant, input_view));
+        throw std::invalid_argument(format("Expected {},  {}", constant, input));
     }
 
-    return input.data() + constant.size();
+    return input.substr(constant.size());
 }
 
-const char* read_number(const string& input, int& number)
+string_view read_number(string_view input, int& number)
 {
     auto result = std::from_chars(input.data(), input.data() + input.size(), number);
     
@@ -62,35 +274,32 @@ const char* read_number(const string& input, int& number)
         throw std::invalid_argument("Failed to parse the number.");
     } 
 
-    return result.ptr;
+    return input.substr(result.ptr - input.data());
 }
 
-pair<int, int> read_rule(const string& line) {
-    auto input = line;
-    pair<int, int> output{};
+rule read_rule(string_view input) {
+    rule output{};
     input = read_number(input, output.first);
     input = expect_string_constant(input, "|");
     input = read_number(input, output.second);
     return output;
 }
 
-vector<int> read_update(string_view input) {
-    size_t start = 0;
-    size_t end = input.find(',');
-    vector<int> numbers;
-
-    while (end != string_view::npos) {
-        numbers.push_back(stoi(string(input.substr(start, end - start))));
-        start = end + 1; // Move past the comma
-        end = input.find(',', start);
+// Appends the comma separated pages on the line as one update
+void read_update(string_view input, update_store& updates) {
+    for (;;) {
+        int page;
+        input = read_number(input, page);
+        updates.pages.push_back(page);
+        if (input.empty()) {
+            break;
+        }
+        input = expect_string_constant(input, ",");
     }
-
-    // Don't forget the last number after the final comma
-    numbers.push_back(stoi(string(input.substr(start))));
-    return numbers;
+    updates.finish();
 }
 
-input read_input(string path) {
+input read_input(string path, pmr::memory_resource* mr) {
     ifstream file(path);
     if (!file.is_open()) {
         throw filesystem::filesystem_error(
@@ -100,7 +309,8 @@ input read_input(string path) {
     }
 
     enum parser_state { READ_RULES, READ_UPDATES } state = READ_RULES;
-    struct input input;
+    struct input input(mr);
+    pmr::vector<rule> rules(mr);
     string line;
     while (getline(file, line)) {
         switch (state) {
@@ -109,10 +319,10 @@ input read_input(string path) {
                     state = READ_UPDATES;
                     continue;
                 }
-                input.rules.push_back(read_rule(line));
+                rules.push_back(read_rule(line));
                 break;
             case READ_UPDATES:
-                input.updates.push_back(read_update(line));
+                read_update(line, input.updates);
                 break;
             default:
                 throw runtime_error("Fudeu");
@@ -120,63 +330,209 @@ input read_input(string path) {
         }
     }
 
+    input.rules = rule_index(rules, mr);
     return input;
 }
 
+// Snapshot layout, bump the version when it changes:
+//   0: the pages in rules, sorted, page i has dense index i
+//   1: rule offsets, successors of page i are successors[offsets[i], offsets[i + 1])
+//   2: successors
+//   3: update offsets, pages of update i are pages[offsets[i], offsets[i + 1])
+//   4: pages
+constexpr string_view snapshot_tag = "2024/05 v3";
+
+void save_input(const input& input, snapshot_writer& out) {
+    out.add(input.rules.page_numbers());
+    out.add(input.rules.offsets());
+    out.add(input.rules.flat_successors());
+    out.add(span<const uint32_t>(input.updates.offsets));
+    out.add(span<const int>(input.updates.pages));
+}
 
-template<typename T>
-constexpr bool in(T value, vector<T> vec) {
-    return find(vec.begin(), vec.end(), value)  != vec.end();
+// CSR offsets must start at 0, never decrease and end at the values size
+bool valid_offsets(span<const uint32_t> offsets, size_t values) {
+    return !offsets.empty() && offsets.front() == 0 && offsets.back() == values
+        && ranges::is_sorted(offsets);
 }
 
-bool valid(const span<const int>& pages_before,
-           const int page,
-           const span<const int>& pages_after,
-           const vector<rule>& rules) {
-    // page should be printed before [print_before]
-    const vector<int> print_before = rules
-        | ranges::views::filter([page](const rule rule) {
-            return rule.second == page;
-        })
-        | ranges::views::transform([](const rule rule) {
-            return rule.first;
-        })
-        | ranges::to<vector>();
+input load_input(const snapshot& snap, pmr::memory_resource* mr) {
+    const auto rule_pages = snap.section<int>(0);
+    const auto rule_offsets = snap.section<uint32_t>(1);
+    const auto successors = snap.section<int>(2);
+    const auto offsets = snap.section<uint32_t>(3);
+    const auto pages = snap.section<int>(4);
+    if (rule_offsets.size() != rule_pages.size() + 1 || ranges::adjacent_find(rule_pages, greater_equal<>{}) != rule_pages.end()
+        || !valid_offsets(rule_offsets, successors.size()) || !valid_offsets(offsets, pages.size())
+        || ranges::any_of(successors, [&](int p) { return !ranges::binary_search(rule_pages, p); })) {
+        throw snapshot_error("Corrupt 2024/05 snapshot");
+    }
 
-    // page should be printed after [print_after]
-    const vector<int> print_after = rules
-        | ranges::views::filter([page](const rule rule) {
-            return rule.first == page;
-        })
-        | ranges::views::transform([](const rule rule) {
-            return rule.second;
-        })
-        | ranges::to<vector>();
+    struct input input(mr);
+    input.rules = rule_index(rule_pages, rule_offsets, successors, mr);
+    input.updates.pages.assign(pages.begin(), pages.end());
+    input.updates.offsets.assign(offsets.begin(), offsets.end());
+    return input;
+}
 
-    for (auto p : pages_before) {
-        if (in(p, print_after))
-            return false;
+// No page may be preceded by a page it has to be printed before. Each page
+// is also checked against itself, as a page with a rule to itself can't be
+// printed at all.
+bool valid(const update& update, const rule_index& rules) {
+    for (size_t i = 0; i < update.size(); ++i) {
+        for (size_t j = 0; j <= i; ++j) {
+            if (rules.precedes(update[i], update[j]))
+                return false;
+        }
     }
+    return true;
+}
 
-    for (auto p : pages_after) {
-        if (in(p, print_before))
-            return false;
+// Ranks of the pages of an update under the rules restricted to it, where
+// the rank of a page is the number of the update's pages it has to be
+// printed before. With antisymmetric rules the update's k pages hold at most
+// k(k-1)/2 rules, so ranks 0..k-1 mean a rule between every pair, and
+// distinct ranks in such a tournament mean the rules order the update
+// totally. The valid order is then by decreasing rank, which is checked
+// in O(k) instead of pair by pair.
+class update_ranks {
+public:
+    explicit update_ranks(const rule_index& rules)
+        : m_rules(rules), m_set(1, rules.pages()) {}
+
+    // Computes the ranks, returns whether they are a total order
+    bool compute(const update& update) {
+        const auto k = update.size();
+        for (auto page : update) {
+            if (const auto p = m_rules.index(page); p != rule_index::npos) {
+                m_set.set(0, p);
+            }
+        }
+        m_ranks.resize(k);
+        m_seen.assign(k, false);
+        bool total = m_rules.antisymmetric();
+        for (size_t i = 0; i < k; ++i) {
+            const auto rank = m_rules.successors_in(update[i], m_set);
+            m_ranks[i] = rank;
+            total = total && rank < k && !m_seen[rank];
+            if (rank < k) {
+                m_seen[rank] = true;
+            }
+        }
+        for (auto page : update) {
+            if (const auto p = m_rules.index(page); p != rule_index::npos) {
+                m_set.reset(0, p);
+            }
+        }
+        return total;
     }
 
-    return true;
-}
+    // Whether the pages come by decreasing rank, meaningful after compute()
+    // returned true
+    bool ordered() const {
+        for (size_t i = 0; i < m_ranks.size(); ++i) {
+            if (m_ranks[i] != m_ranks.size() - 1 - i)
+                return false;
+        }
+        return true;
+    }
 
-bool valid(const vector<int>& update,
-           const vector<rule>& rules) {
-    for (size_t i = 0; i < update.size(); ++i) {
-        assert(update.size() > i);
-        const auto upd = update[i];
-        const span<const int> before(update.begin(), i + 1);
-        const span<const int> after(update.begin() + i, update.size() - i);
-        if (!valid(before, upd, after, rules))
-            return false;
+    // The page that ends up in the middle once the update is ordered
+    int middle(const update& update) const {
+        const auto k = update.size();
+        for (size_t i = 0; i < k; ++i) {
+            if (m_ranks[i] == k - 1 - k / 2)
+                return update[i];
+        }
+        throw logic_error("Update ranks are not a permutation");
     }
-    return true;
+
+private:
+    const rule_index& m_rules;
+    bitboard m_set;
+    vector<size_t> m_ranks;
+    vector<bool> m_seen;
+};
+
+// Middle page of the update once ordered by the rules, for updates the
+// rules don't order totally. Pages are placed one at a time, each time the
+// first remaining page (in update order) that no remaining page has to
+// precede: a topological sort, which needs no strict weak ordering. Pages
+// caught in a rule cycle can't be ordered and follow in update order.
+int ordered_middle(const update& update, const rule_index& rules) {
+    const auto k = update.size();
+    vector<size_t> predecessors(k, 0);
+    vector<bool> placed(k, false);
+    for (size_t i = 0; i < k; ++i) {
+        for (size_t j = 0; j < k; ++j) {
+            predecessors[i] += i != j && rules.precedes(update[j], update[i]);
+        }
+    }
+    for (size_t n = 0;; ++n) {
+        size_t next = k;
+        for (size_t i = 0; i < k && next == k; ++i) {
+            if (!placed[i] && predecessors[i] == 0)
+                next = i;
+        }
+        for (size_t i = 0; i < k && next == k; ++i) {
+            if (!placed[i])
+                next = i;
+        }
+        if (n == k / 2)
+            return update[next];
+        placed[next] = true;
+        for (size_t j = 0; j < k; ++j) {
+            if (!placed[j] && predecessors[j] > 0 && rules.precedes(update[next], update[j]))
+                predecessors[j]--;
+        }
+    }
+}
+
+TEST(OrderTests, SparsePageNumbers) {
+    const rule rules[] = {{1000000, 5}, {5, 2000000000}, {1000000, 2000000000}};
+    const rule_index index(rules, pmr::get_default_resource());
+    ASSERT_EQ(index.pages(), 3);
+    ASSERT_TRUE(index.precedes(1000000, 5));
+    ASSERT_FALSE(index.precedes(5, 1000000));
+    ASSERT_FALSE(index.precedes(6, 5));
+    ASSERT_EQ(index.successors(1000000).size(), 2);
+    const int pages[] = {2000000000, 5, 1000000};
+    update_ranks ranks(index);
+    ASSERT_TRUE(ranks.compute(pages));
+    ASSERT_FALSE(ranks.ordered());
+    ASSERT_EQ(ranks.middle(pages), 5);
+}
+
+TEST(OrderTests, PartialOrderMiddle) {
+    const rule rules[] = {{1, 2}, {3, 4}};
+    const rule_index index(rules, pmr::get_default_resource());
+    const int pages[] = {2, 1, 4, 3, 5};
+    update_ranks ranks(index);
+    ASSERT_FALSE(ranks.compute(pages));
+    ASSERT_FALSE(valid(pages, index));
+    // placed as 1, 2, 3, 4, 5
+    ASSERT_EQ(ordered_middle(pages, index), 3);
+}
+
+TEST(OrderTests, TotalOrderMiddleMatchesRanks) {
+    const rule rules[] = {{1, 2}, {1, 3}, {1, 4}, {2, 3}, {2, 4}, {3, 4}};
+    const rule_index index(rules, pmr::get_default_resource());
+    const int pages[] = {4, 2, 1, 3, 0};
+    update_ranks ranks(index);
+    const int ordered[] = {1, 2, 3};
+    ASSERT_TRUE(ranks.compute(span(pages, 4)));
+    ASSERT_EQ(ranks.middle(span(pages, 4)), ordered_middle(span(pages, 4), index));
+    ASSERT_EQ(ordered_middle(ordered, index), 2);
+    // 0 has no rules, so the update isn't totally ordered
+    ASSERT_FALSE(ranks.compute(pages));
+}
+
+TEST(OrderTests, CycleMiddle) {
+    const rule rules[] = {{1, 2}, {2, 3}, {3, 1}};
+    const rule_index index(rules, pmr::get_default_resource());
+    const int pages[] = {3, 2, 1};
+    // 3 is placed first to break the cycle, which frees 1
+    ASSERT_EQ(ordered_middle(pages, index), 1);
 }
 
 int middle(const update& update) {
@@ -188,18 +544,82 @@ int middle(const update& update) {
     return middle;
 }
 
+// Sums of the middle pages of the valid updates and of the invalid ones once
+// ordered, and how many updates the ranks could decide
+struct totals {
+    int valid = 0;
+    int repaired = 0;
+    size_t ranked = 0;
+
+    friend totals operator+(totals a, const totals& b) {
+        a.valid += b.valid;
+        a.repaired += b.repaired;
+        a.ranked += b.ranked;
+        return a;
+    }
+};
+
+// Updates the rules don't order totally fall back to the pairwise check and
+// to a topological sort for the middle page
+totals solve(thread_pool& pool, const input& input) {
+    const auto& updates = input.updates;
+    const auto chunks = min<size_t>(updates.size(), pool.size() * 4);
+    return parallel_reduce(pool, 0, chunks, totals{},
+        [&](size_t chunk) {
+            update_ranks ranks(input.rules);
+            totals found;
+            for (auto i = chunk; i < updates.size(); i += chunks) {
+                const auto update = updates[i];
+                if (ranks.compute(update)) {
+                    found.ranked++;
+                    if (ranks.ordered()) {
+                        found.valid += middle(update);
+                    } else {
+                        found.repaired += ranks.middle(update);
+                    }
+                } else if (valid(update, input.rules)) {
+                    found.valid += middle(update);
+                } else {
+                    found.repaired += ordered_middle(update, input.rules);
+                }
+            }
+            return found;
+        },
+        plus<>(), 1);
+}
+
 int main(int argc, char* argv[]) {
-    input input = read_input(argv[1]);
+    const char* run_tests = getenv("RUN_GTEST");
+    if (run_tests != nullptr && string(run_tests) != "") {
+        ::testing::InitGoogleTest(&argc, argv);
+        return RUN_ALL_TESTS();
+    }
+
+    const auto opts = parse_options(argc, argv);
+    perf_stats::session perf(opts.perf);
+    thread_pool pool(opts.threads);
+
+    // ints take about as much room as their digits and separators
+    arena input_arena(arena::hint(opts.input, 2));
+    auto* mr = input_arena.resource();
+
+    alloc_stats::phase parse("parse");
+    input input = opts.snapshot
+        ? load_or_parse(opts.input, snapshot_tag, [mr](const auto& path) { return read_input(path, mr); },
+                        save_input, [mr](const snapshot& snap) { return load_input(snap, mr); })
+        : read_input(opts.input, mr);
+    parse.stop();
     print_input(input);
 
-    int output = 0;
-    for (auto update : input.updates) {
-        if (valid(update, input.rules)) {
-            output += middle(update);
-        }
-    }
+    alloc_stats::phase part1("part1+part2");
+    const auto output = solve(pool, input);
+    part1.stop();
 
-    cout << "Ouptut: " << output << endl;
+    cout << "Ouptut: " << output.valid << endl;
+    cout << "Output 2: " << output.repaired << endl;
+    if (opts.stats) {
+        cerr << "Ranked: " << output.ranked << " of " << input.updates.size() << endl;
+    }
 
     return 0; 
 }
@@ -1,10 +1,24 @@
 #include <cstdlib>
 #include <algorithm>
+#include <atomic>
+#include <bit>
 #include <cassert>
+#include <chrono>
 #include <cmath>
+#include <cstdint>
 #include <filesystem>
 #include <functional>
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <random>
+#include <memory_resource>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <sstream>
+#include <string>
+#include <string_view>
 #include <fstream>
 #include <ostream>
 #include <ranges>
@@ -14,12 +28,22 @@
 #include <vector>
 #include <expected>
 
+#include <gtest/gtest.h>
 
-// Parsed input type
-using input = std::vector<std::vector<char>>;
+#include "alloc_stats.hpp"
+#include "arena.hpp"
+#include "bitboard.hpp"
+#include "options.hpp"
+#include "perf_stats.hpp"
+#include "ring_buffer.hpp"
+#include "thread_pool.hpp"
+
+
+// Parsed input type, rows share the outer vector's memory resource
+using input = std::pmr::vector<std::pmr::vector<char>>;
 
 // Parse the input string into nested std::vector
-input readinput(std::string path) {
+input readinput(std::string path, std::pmr::memory_resource* mr) {
     std::ifstream file(path);
     if (!file.is_open()) {
         throw std::filesystem::filesystem_error(
@@ -29,11 +53,12 @@ input readinput(std::string path) {
     }
 
     std::string line;
-    std::vector<std::vector<char>> lines;
+    input lines(mr);
     while (getline(file, line)) {
-        std::vector<char> linevec(line.begin(), line.end());
+        auto& linevec = lines.emplace_back();
+        linevec.reserve(line.size() + 1);
+        linevec.assign(line.begin(), line.end());
         linevec.push_back('\n');
-        lines.push_back(linevec);
     }
     return lines;
 }
@@ -75,60 +100,246 @@ std::ostream& operator<<(std::ostream& os, const point& p) {
     return os;
 }
 
-struct matrix {
-    matrix(const input&& inp) : m_mat(std::move(inp)) {
-        auto find_func = [](char ch) { return ch == '^' || ch == 'v' || ch == '<' || ch == '>'; };
-        if (auto p = find(find_func)) {
-            m_pos = p.value();
+#if DEBUG_RENDER
+// Draws the guard's walk on the terminal from its own thread.
+//
+// The solver hands over one segment per straight move through a lock-free
+// ring and never waits for the terminal. When the renderer falls behind and
+// the ring is full, the segment is coalesced into a visited bitmap on the
+// solver side instead, which is swapped out to the renderer whenever its
+// lock is free. Segments are numbered so the guard is drawn where the newest
+// one left it, whichever way it arrived. The renderer keeps its own copy of
+// the screen, wakes up at most `fps` times per second, applies whatever
+// arrived and rewrites only the cells that changed using cursor addressing.
+class renderer {
+public:
+    // The guard walked from (x0, y0) to (x1, y1) and now faces `guard`
+    struct segment {
+        std::uint32_t x0, y0, x1, y1;
+        char guard;
+        std::uint64_t seq = 0;
+    };
+
+    static constexpr unsigned fps = 30;
+
+    // `frame` is the initial picture as printed by operator<<(matrix), which
+    // puts two header lines above the map and 6 columns left of it
+    renderer(const bitboard& obstacles, const point& guard, std::string frame)
+        : m_rows(obstacles.rows()), m_columns(obstacles.columns()),
+          m_screen(m_rows * m_columns, '.'),
+          m_dirty(m_rows, m_columns),
+          m_guard{static_cast<std::uint32_t>(guard.x), static_cast<std::uint32_t>(guard.y),
+                  static_cast<std::uint32_t>(guard.x), static_cast<std::uint32_t>(guard.y), guard.ch},
+          m_snapshot(m_rows, m_columns),
+          m_ring(std::make_unique<spsc_ring<segment, 4096>>()),
+          m_overflow(m_rows, m_columns),
+          m_shared(m_rows, m_columns)
+    {
+        for (std::size_t x = 0; x < m_rows; ++x)
+            for (std::size_t y = 0; y < m_columns; ++y)
+                if (obstacles.test(x, y))
+                    m_screen[x * m_columns + y] = '#';
+        m_screen[guard.x * m_columns + guard.y] = guard.ch;
+
+        std::cout << "\x1b[2J\x1b[H" << frame << std::flush;
+        m_thread = std::jthread([this](std::stop_token stop) { loop(stop); });
+    }
+
+    // Hands over what is still coalesced, flushes the remaining segments and
+    // leaves the cursor below the map
+    ~renderer() {
+        if (m_overflowed) {
+            hand_over(std::unique_lock(m_mutex));
         }
+        m_thread.request_stop();
+        m_thread.join();
     }
 
-    size_t run() {
-        std::cout << "Running " << std::endl;
-        while (step()) {
-            render();
-        };
+    // Called by the solver thread, never blocks
+    void push(segment s) {
+        s.seq = ++m_pushed;
+        if (m_ring->try_push(s))
+            return;
 
-        return m_steps;
+        for (auto x = std::min(s.x0, s.x1); x <= std::max(s.x0, s.x1); ++x)
+            m_overflow.set_range(x, std::min(s.y0, s.y1), std::max(s.y0, s.y1) + 1);
+        m_overflow_guard = s;
+        m_overflowed = true;
+        m_coalesced.fetch_add(1, std::memory_order_relaxed);
+        hand_over(std::unique_lock(m_mutex, std::try_to_lock));
     }
 
 private:
+    // Solver side: merges the coalesced segments into the shared bitmap
+    // when `lock` got the mutex, otherwise keeps them for the next push
+    void hand_over(std::unique_lock<std::mutex> lock) {
+        if (!lock.owns_lock())
+            return;
+        m_shared |= m_overflow;
+        m_shared_guard = m_overflow_guard;
+        m_shared_ready = true;
+        m_overflow.clear();
+        m_overflowed = false;
+    }
 
-    void render() {
-#if DEBUG_RENDER
-        system("clear");
-        std::cout << "Step " << m_steps << std::endl;
-        std::cout << *this;
-        std::this_thread::sleep_for(std::chrono::milliseconds(200));
-#endif
+    void loop(std::stop_token stop) {
+        auto next = std::chrono::steady_clock::now();
+        while (!stop.stop_requested()) {
+            next += std::chrono::milliseconds(1000 / fps);
+            std::this_thread::sleep_until(next);
+            draw();
+        }
+        draw();
+        std::cout << std::format("\x1b[{};1H", m_rows + 4) << std::flush;
     }
-    bool step() {
-        auto newpos = move(m_pos);
-        char square = get(newpos);
-
-        switch (square) {
-            case '.':
-                ++m_steps;
-                // no break! falling through into below case
-            case 'X':
-                update_map(newpos, m_pos.ch);
-                m_pos = newpos;
-                break;
-            case '#':
-                m_pos.ch = turn(m_pos.ch);
-                update_map(m_pos, m_pos.ch);
-                break;
-            case '\0':
-                // we reached the out of the map
-                ++m_steps;
-                return false;
-            default:
-                throw std::invalid_argument(std::format("Unexpected value in step {}", square));
+
+    void draw() {
+        while (auto s = m_ring->try_pop()) {
+            apply(*s);
+        }
+        if (take_snapshot()) {
+            for (std::size_t x = 0; x < m_rows; ++x)
+                for (auto y = m_snapshot.next_in_row(x, 0); y < m_columns; y = m_snapshot.next_in_row(x, y + 1))
+                    visit(x, y);
+            move_guard(m_snapshot_guard);
+            m_snapshot.clear();
         }
 
+        std::string out;
+        for (std::size_t x = 0; x < m_rows; ++x) {
+            for (auto y = m_dirty.next_in_row(x, 0); y < m_columns; y = m_dirty.next_in_row(x, y + 1)) {
+                out += std::format("\x1b[{};{}H{}", x + 3, y + 7, m_screen[x * m_columns + y]);
+            }
+        }
+        m_dirty.clear();
+        out += std::format("\x1b[{};1HSegments {} coalesced {}\x1b[K", m_rows + 3, m_segments,
+                           m_coalesced.load(std::memory_order_relaxed));
+        std::cout << out << std::flush;
+    }
+
+    // Swaps the shared bitmap with the cleared snapshot, if there is one
+    bool take_snapshot() {
+        std::lock_guard lock(m_mutex);
+        if (!m_shared_ready)
+            return false;
+        std::swap(m_shared, m_snapshot);
+        m_snapshot_guard = m_shared_guard;
+        m_shared_ready = false;
         return true;
     }
 
+    void put(std::size_t x, std::size_t y, char ch) {
+        auto& cell = m_screen[x * m_columns + y];
+        if (cell != ch) {
+            cell = ch;
+            m_dirty.set(x, y);
+        }
+    }
+
+    // Marks a walked cell, unless a newer segment left the guard there
+    void visit(std::size_t x, std::size_t y) {
+        if (x != m_guard.x1 || y != m_guard.y1)
+            put(x, y, 'X');
+    }
+
+    void move_guard(const segment& s) {
+        if (s.seq < m_guard.seq)
+            return;
+        put(m_guard.x1, m_guard.y1, 'X');
+        put(s.x1, s.y1, s.guard);
+        m_guard = s;
+    }
+
+    void apply(const segment& s) {
+        for (auto x = std::min(s.x0, s.x1); x <= std::max(s.x0, s.x1); ++x)
+            for (auto y = std::min(s.y0, s.y1); y <= std::max(s.y0, s.y1); ++y)
+                visit(x, y);
+        move_guard(s);
+        ++m_segments;
+    }
+
+    std::size_t m_rows;
+    std::size_t m_columns;
+    // owned by the renderer thread once it started
+    std::string m_screen;
+    bitboard m_dirty;
+    std::size_t m_segments = 0;
+    segment m_guard;
+    bitboard m_snapshot;
+    segment m_snapshot_guard{};
+
+    std::unique_ptr<spsc_ring<segment, 4096>> m_ring;
+    std::atomic<std::size_t> m_coalesced{0};
+
+    // owned by the solver thread
+    std::uint64_t m_pushed = 0;
+    bitboard m_overflow;
+    segment m_overflow_guard{};
+    bool m_overflowed = false;
+
+    // guarded by m_mutex
+    std::mutex m_mutex;
+    bitboard m_shared;
+    segment m_shared_guard{};
+    bool m_shared_ready = false;
+
+    std::jthread m_thread;
+};
+#endif
+
+struct matrix {
+    matrix(const input&& inp)
+        : m_obstacles(inp.size(), columns_of(inp)),
+          m_obstacles_t(columns_of(inp), inp.size()),
+          m_visited(inp.size(), columns_of(inp))
+    {
+        for (std::size_t x = 0; x < max_rows(); ++x) {
+            for (std::size_t y = 0; y < max_columns() && y < inp[x].size(); ++y) {
+                const char ch = inp[x][y];
+                if (ch == '#') {
+                    m_obstacles.set(x, y);
+                    m_obstacles_t.set(y, x);
+                } else if (valid(ch)) {
+                    m_pos = m_start = point{x, y, ch};
+                } else if (ch != '.') {
+                    throw std::invalid_argument(std::format("Unexpected value in map {}", ch));
+                }
+            }
+        }
+    }
+
+    // Walks at most `segments` straight moves, all of them by default
+    size_t run(size_t segments = std::numeric_limits<size_t>::max()) {
+        std::cout << "Running " << std::endl;
+        m_visited.set(m_pos.x, m_pos.y);
+#if DEBUG_RENDER
+        std::ostringstream frame;
+        frame << *this;
+        m_renderer = std::make_unique<renderer>(m_obstacles, m_pos, frame.str());
+#endif
+        auto from = m_pos;
+        bool inside = true;
+        while (inside && segments-- > 0) {
+            inside = advance();
+            render(from);
+            from = m_pos;
+        }
+#if DEBUG_RENDER
+        m_renderer.reset();
+#endif
+
+        return m_visited.count();
+    }
+
+    // The map as parsed, for solvers working on their own copy
+    const bitboard& obstacles() const {
+        return m_obstacles;
+    }
+
+    const point& start() const {
+        return m_start;
+    }
+
     static char turn(char ch) {
         switch (ch) {
             case '^':
@@ -144,59 +355,88 @@ private:
         }
     }
 
-    static bool valid(const char direction) {
-        switch (direction) {
-            case '^':
-            case '>':
-            case 'v':
-            case '<':
-                return true;
-            default:
-                return false;
-        }
-    }
+private:
 
-    bool valid(const point& newpos) const {
-        return max_rows() > newpos.x && max_columns() > newpos.y;
+    // Hands the segment walked since `from` to the renderer
+    void render([[maybe_unused]] const point& from) {
+#if DEBUG_RENDER
+        m_renderer->push({static_cast<std::uint32_t>(from.x), static_cast<std::uint32_t>(from.y),
+                          static_cast<std::uint32_t>(m_pos.x), static_cast<std::uint32_t>(m_pos.y),
+                          m_pos.ch});
+#endif
     }
 
-    // Update the map with X to keep a record
-    // of the visited squares
-    void update_map(const point& p, char ch) {
-        if (!valid(ch)) {
-            throw std::invalid_argument(std::format("Invalid argument for update_map {}", ch));
-        }
-        if (valid(p)) {
-            auto [x, y, _] = p;
-            auto [oldx, oldy, __] = m_pos;
-            m_mat[oldx][oldy] = 'X';
-            m_mat[x][y] = ch;
+    // Moves the guard straight ahead until it is blocked or leaves the
+    // map, marking every square on the way. The next obstacle is a bit scan
+    // over the obstacle row, or over the transposed plane when moving
+    // vertically. Returns false once the guard left the map, standing on
+    // the last square before the edge.
+    bool advance() {
+        constexpr auto npos = bitboard::npos;
+        auto& [x, y, ch] = m_pos;
+        switch (ch) {
+            case '>': {
+                auto o = m_obstacles.next_in_row(x, y);
+                m_visited.set_range(x, y, o);
+                y = o - 1;
+                if (o == max_columns())
+                    return false;
+                break;
+            }
+            case '<': {
+                auto o = m_obstacles.prev_in_row(x, y);
+                m_visited.set_range(x, o == npos ? 0 : o + 1, y + 1);
+                y = o == npos ? 0 : o + 1;
+                if (o == npos)
+                    return false;
+                break;
+            }
+            case 'v': {
+                auto o = m_obstacles_t.next_in_row(y, x);
+                for (auto r = x; r < o; ++r)
+                    m_visited.set(r, y);
+                x = o - 1;
+                if (o == max_rows())
+                    return false;
+                break;
+            }
+            case '^': {
+                auto o = m_obstacles_t.prev_in_row(y, x);
+                for (auto r = (o == npos ? 0 : o + 1); r <= x; ++r)
+                    m_visited.set(r, y);
+                x = o == npos ? 0 : o + 1;
+                if (o == npos)
+                    return false;
+                break;
+            }
+            default:
+                throw std::invalid_argument(std::format("Invalid argument to advance {}", ch));
         }
+
+        ch = turn(ch);
+        return true;
     }
 
-    // Returns a new position, possibly invalid
-    static point move(const point& pos) {
-        point copy = pos;
-        switch (pos.ch) {
+    static bool valid(const char direction) {
+        switch (direction) {
             case '^':
-                --copy.x;
-                break;
             case '>':
-                ++copy.y;
-                break;
             case 'v':
-                ++copy.x;
-                break;
             case '<':
-                --copy.y;
-                break;
+                return true;
             default:
-                throw std::invalid_argument(std::format("Invalid argument to move {}", pos.ch));
-                break;
+                return false;
         }
-        return copy;
     }
 
+    // Lines carry a trailing '\n' from readinput
+    static size_t columns_of(const input& inp) {
+        if (inp.empty()) {
+            return 0;
+        }
+        auto& first = inp[0];
+        return !first.empty() && first.back() == '\n' ? first.size() - 1 : first.size();
+    }
 
     // get a square in the table
     //
@@ -204,66 +444,41 @@ private:
     //   . -> non-visited square
     //   # -> an obstacle
     //   X -> a visited square
-    char get(const point& pos) const {
-        if (valid(pos)) {
-            auto ch  = m_mat[pos.x][pos.y];
-            switch (ch) {
-                case '.':
-                    return '.';
-                case '#':
-                    return '#';
-                case 'X':
-                    return 'X';
-                default:
-                    throw std::invalid_argument(std::format("Invalid argument to get {}", ch));
-            }
-        } else {
-            return '\0';
-        }
+    char get(size_t x, size_t y) const {
+        if (m_obstacles.test(x, y))
+            return '#';
+        if (m_visited.test(x, y))
+            return 'X';
+        return '.';
     }
 
     size_t max_columns() const {
-        if (m_mat.size() == 0) {
-            return 0;
-        }
-
-        return m_mat[0].size();
+        return m_obstacles.columns();
     }
 
     size_t max_rows() const {
-        return m_mat.size();
+        return m_obstacles.rows();
     }
 
-    const std::vector<char>& row(int x) {
-        return m_mat[x];
-    }
-
-    std::optional<point> find(
-        std::function<bool(char ch)> cb) {
-        for (std::size_t x = 0; x < m_mat.size(); ++x) {
-            for (std::size_t y = 0; y < m_mat[x].size(); ++y) {
-                const char ch = m_mat[x][y];
-                if (cb(ch)) {
-                    return point{x, y, ch};
-                }
-            }
-        }
-        return std::nullopt;
-    }
-
-    uint64_t m_steps = 0;
+    struct point m_start;
     struct point m_pos;
-    std::vector<std::vector<char>> m_mat;
+    // obstacles by row and by column (transposed), squares the guard walked
+    bitboard m_obstacles;
+    bitboard m_obstacles_t;
+    bitboard m_visited;
+#if DEBUG_RENDER
+    std::unique_ptr<renderer> m_renderer;
+#endif
     friend std::ostream& operator<<(std::ostream& os, const matrix& m);
 };
 
 std::ostream& operator<<(std::ostream& os, const matrix& m) {
-    if (m.m_mat.empty()) {
+    if (m.max_rows() == 0) {
         return os;
     }
 
     os << "      ";
-    auto columns =  m.max_columns()-1;
+    auto columns =  m.max_columns();
     auto range = std::views::iota(0u, columns);
     std::ranges::for_each(range, [&os](auto i){
         os << i % 10;
@@ -275,23 +490,594 @@ std::ostream& operator<<(std::ostream& os, const matrix& m) {
         | std::views::take(columns)
         | std::ranges::to<std::string>();
     os << hbar << std::endl;
-    for (auto i = 0; i < m.m_mat.size(); ++i) {
-        os << std::format("{: 3} - ", i);
-        for (auto j = 0; j < m.m_mat.size(); ++j) {
-            os << m.m_mat[i][j];
+    for (size_t i = 0; i < m.max_rows(); ++i) {
+        os << std::format("{:3} - ", i);
+        for (size_t j = 0; j < columns; ++j) {
+            os << (i == m.m_pos.x && j == m.m_pos.y ? m.m_pos.ch : m.get(i, j));
         }
         os << std::endl;
     }
     return os;
 }
 
+// Guard walk that can be re-queried cheaply while the map is edited.
+//
+// The walk is kept as a list of states (square and direction), one per move
+// or turn, together with the first step in which each state occurs and the
+// first step in which the guard bumped into each obstacle. Adding an
+// obstacle only changes the walk from the step before the guard first
+// entered that square, and removing one from the first step that bumped
+// into it, so an edit rolls back the walk to that step and re-simulates
+// from there. The cost of an edit is the length of the replaced suffix.
+class guard_solver {
+public:
+    guard_solver(bitboard obstacles, const point& start)
+        : m_obstacles(std::move(obstacles)),
+          m_first(cells() * 4, none),
+          m_bump(cells(), none)
+    {
+        const auto dir = std::string_view("^>v<").find(start.ch);
+        if (dir == std::string_view::npos) {
+            throw std::invalid_argument(std::format("Invalid guard direction {}", start.ch));
+        }
+        push(state{static_cast<std::uint32_t>(start.x), static_cast<std::uint32_t>(start.y),
+                   static_cast<std::uint8_t>(dir)});
+        extend();
+    }
+
+    // Distinct squares walked, or walked before the loop closed
+    size_t visited() const {
+        return m_distinct.back();
+    }
+
+    bool loops() const {
+        return m_loops;
+    }
+
+    // States in the walk, including the starting one
+    size_t length() const {
+        return m_path.size();
+    }
+
+    bool obstacle(size_t x, size_t y) const {
+        return m_obstacles.test(x, y);
+    }
+
+    void add_obstacle(size_t x, size_t y) {
+        if (m_obstacles.test(x, y)) {
+            return;
+        }
+        const auto c = cell(x, y);
+        const auto entered = std::ranges::min(std::span(m_first).subspan(c * 4, 4));
+        if (entered == 0) {
+            throw std::invalid_argument(std::format("Obstacle over the guard at {},{}", x, y));
+        }
+        m_obstacles.set(x, y);
+        if (entered != none) {
+            resimulate(entered - 1);
+        }
+    }
+
+    void remove_obstacle(size_t x, size_t y) {
+        if (!m_obstacles.test(x, y)) {
+            return;
+        }
+        m_obstacles.reset(x, y);
+        if (const auto bumped = m_bump[cell(x, y)]; bumped != none) {
+            resimulate(bumped);
+        }
+    }
+
+    // Squares of the current walk in the order they were first entered
+    std::vector<std::pair<size_t, size_t>> squares() const {
+        std::vector<std::pair<size_t, size_t>> output;
+        for (size_t i = 0; i < m_path.size(); ++i) {
+            if (i == 0 || m_distinct[i] != m_distinct[i - 1]) {
+                output.emplace_back(m_path[i].x, m_path[i].y);
+            }
+        }
+        return output;
+    }
+
+private:
+    static constexpr std::uint32_t none = std::numeric_limits<std::uint32_t>::max();
+
+    struct state {
+        std::uint32_t x, y;
+        std::uint8_t dir; // index into "^>v<"
+    };
+
+    size_t cells() const {
+        return m_obstacles.rows() * m_obstacles.columns();
+    }
+
+    size_t cell(size_t x, size_t y) const {
+        return x * m_obstacles.columns() + y;
+    }
+
+    // Square in front of s, if it is inside the map
+    std::optional<std::pair<size_t, size_t>> ahead(const state& s) const {
+        constexpr int dx[] = {-1, 0, 1, 0};
+        constexpr int dy[] = {0, 1, 0, -1};
+        const auto x = static_cast<size_t>(s.x + dx[s.dir]);
+        const auto y = static_cast<size_t>(s.y + dy[s.dir]);
+        if (x >= m_obstacles.rows() || y >= m_obstacles.columns()) {
+            return std::nullopt;
+        }
+        return std::make_pair(x, y);
+    }
+
+    void push(const state& s) {
+        const auto step = static_cast<std::uint32_t>(m_path.size());
+        const auto c = cell(s.x, s.y);
+        const auto first = std::span(m_first).subspan(c * 4, 4);
+        const bool seen = std::ranges::any_of(first, [](auto f) { return f != none; });
+        m_distinct.push_back((m_distinct.empty() ? 0 : m_distinct.back()) + !seen);
+        first[s.dir] = step;
+        m_path.push_back(s);
+    }
+
+    // Walks from the last state until the guard leaves or repeats a state
+    void extend() {
+        m_loops = false;
+        while (true) {
+            const auto step = static_cast<std::uint32_t>(m_path.size() - 1);
+            auto next = m_path.back();
+            const auto front = ahead(next);
+            if (!front) {
+                return;
+            }
+            const auto [x, y] = *front;
+            if (m_obstacles.test(x, y)) {
+                auto& bump = m_bump[cell(x, y)];
+                bump = std::min(bump, step);
+                next.dir = (next.dir + 1) % 4;
+            } else {
+                next.x = x;
+                next.y = y;
+            }
+            if (m_first[cell(next.x, next.y) * 4 + next.dir] != none) {
+                m_loops = true;
+                return;
+            }
+            push(next);
+        }
+    }
+
+    // Drops every state after `step` and walks again from it
+    void resimulate(size_t step) {
+        for (auto i = m_path.size(); i-- > step;) {
+            const auto& s = m_path[i];
+            if (const auto front = ahead(s)) {
+                auto& bump = m_bump[cell(front->first, front->second)];
+                if (bump == i) {
+                    bump = none;
+                }
+            }
+            if (i > step) {
+                m_first[cell(s.x, s.y) * 4 + s.dir] = none;
+            }
+        }
+        m_path.resize(step + 1);
+        m_distinct.resize(step + 1);
+        extend();
+    }
+
+    bitboard m_obstacles;
+    std::vector<state> m_path;
+    // distinct squares in m_path[0..i]
+    std::vector<std::uint32_t> m_distinct;
+    // first step of each (square, direction) state, per square 4 entries
+    std::vector<std::uint32_t> m_first;
+    // first step that bumped into each obstacle square
+    std::vector<std::uint32_t> m_bump;
+    bool m_loops = false;
+};
+
+// The guard's walk as a graph over its turns.
+//
+// Between two turns the guard walks straight into an obstacle, so the walk
+// is described by the obstacles it bumps into and the direction it walked
+// into each. Those (obstacle, direction) states form a functional graph:
+// every state has one successor, the obstacle met after turning right, or
+// the exit. Binary lifting tables hold the state 2^j turns later and the
+// squares walked on the way, so the position after k turns and the distance
+// walked take O(log k) however long the walk is, and the walk loops exactly
+// when its state never reaches the exit.
+class turn_graph {
+public:
+    static constexpr std::uint32_t exit = 0;
+
+    struct position {
+        std::uint32_t state;
+        // moves from square to square so far
+        std::uint64_t steps;
+    };
+
+    // Turns and moves until the guard leaves the map or, when it loops,
+    // until it first bumps into an obstacle from the same direction again
+    struct summary {
+        bool loops;
+        std::uint64_t turns;
+        std::uint64_t steps;
+    };
+
+    explicit turn_graph(const bitboard& obstacles)
+        : m_obstacles(obstacles),
+          m_obstacles_t(obstacles.columns(), obstacles.rows())
+    {
+        for (size_t x = 0; x < rows(); ++x) {
+            for (auto y = obstacles.next_in_row(x, 0); y < columns(); y = obstacles.next_in_row(x, y + 1)) {
+                m_obstacles_t.set(y, x);
+                m_cells.push_back(x * columns() + y);
+            }
+        }
+
+        const auto states = 1 + 4 * m_cells.size();
+        // 2^(levels - 1) >= states turns reach the exit from any state that
+        // doesn't loop
+        const auto levels = static_cast<size_t>(std::bit_width(states)) + 1;
+        m_next.assign(levels, std::vector<std::uint32_t>(states, exit));
+        m_steps.assign(levels, std::vector<std::uint64_t>(states, 0));
+        for (size_t k = 0; k < m_cells.size(); ++k) {
+            for (std::uint8_t dir = 0; dir < 4; ++dir) {
+                // the square in front of the obstacle, if the guard can stand there
+                const auto x = m_cells[k] / columns() - dx[dir];
+                const auto y = m_cells[k] % columns() - dy[dir];
+                if (x >= rows() || y >= columns() || m_obstacles.test(x, y)) {
+                    continue;
+                }
+                const auto [next, steps] = slide(x, y, (dir + 1) % 4);
+                m_next[0][state(k, dir)] = next;
+                m_steps[0][state(k, dir)] = steps;
+            }
+        }
+        for (size_t j = 1; j < levels; ++j) {
+            for (size_t s = 0; s < states; ++s) {
+                const auto half = m_next[j - 1][s];
+                m_next[j][s] = m_next[j - 1][half];
+                m_steps[j][s] = m_steps[j - 1][s] + m_steps[j - 1][half];
+            }
+        }
+    }
+
+    // Where the guard first bumps into an obstacle (or leaves) from `start`
+    position start(const point& start) const {
+        const auto dir = std::string_view("^>v<").find(start.ch);
+        if (dir == std::string_view::npos) {
+            throw std::invalid_argument(std::format("Invalid guard direction {}", start.ch));
+        }
+        const auto [state, steps] = slide(start.x, start.y, dir);
+        return {state, steps};
+    }
+
+    // Where the guard is `turns` turns after `from`. Past the table's reach
+    // of 2^top turns the walk has left or is going round its loop, so the
+    // rest is taken modulo the loop, found by following it once: any number
+    // of turns costs O(states + levels).
+    position after(position from, std::uint64_t turns) const {
+        const auto top = m_next.size() - 1;
+        if (turns >> top > 0) {
+            jump(from, top);
+            turns -= std::uint64_t{1} << top;
+            if (from.state == exit) {
+                return from;
+            }
+            std::uint64_t cycle = 0;
+            position round{from.state, 0};
+            do {
+                jump(round, 0);
+                ++cycle;
+            } while (round.state != from.state);
+            from.steps += turns / cycle * round.steps;
+            turns %= cycle;
+        }
+        for (size_t j = 0; turns > 0; ++j, turns >>= 1) {
+            if (turns & 1) {
+                jump(from, j);
+            }
+        }
+        return from;
+    }
+
+    summary walk(const point& start) const {
+        auto at = this->start(start);
+        const auto top = m_next.size() - 1;
+        if (m_next[top][at.state] != exit) {
+            // Brent's cycle finding over single turns
+            std::uint64_t power = 1, cycle = 1;
+            auto tortoise = at.state;
+            auto hare = m_next[0][at.state];
+            while (tortoise != hare) {
+                if (power == cycle) {
+                    tortoise = hare;
+                    power *= 2;
+                    cycle = 0;
+                }
+                hare = m_next[0][hare];
+                ++cycle;
+            }
+            std::uint64_t tail = 0;
+            for (auto slow = at.state, fast = after({at.state, 0}, cycle).state; slow != fast; ++tail) {
+                slow = m_next[0][slow];
+                fast = m_next[0][fast];
+            }
+            return {true, tail + cycle, after(at, tail + cycle).steps};
+        }
+
+        // the largest number of turns still inside the map, bit by bit
+        std::uint64_t turns = 0;
+        for (auto j = top + 1; j-- > 0;) {
+            if (at.state != exit && m_next[j][at.state] != exit) {
+                jump(at, j);
+                turns += std::uint64_t{1} << j;
+            }
+        }
+        if (at.state != exit) {
+            jump(at, 0);
+            ++turns;
+        }
+        return {false, turns, at.steps};
+    }
+
+    size_t states() const {
+        return m_next.front().size();
+    }
+
+private:
+    static constexpr size_t dx[] = {static_cast<size_t>(-1), 0, 1, 0};
+    static constexpr size_t dy[] = {0, 1, 0, static_cast<size_t>(-1)};
+
+    size_t rows() const {
+        return m_obstacles.rows();
+    }
+
+    size_t columns() const {
+        return m_obstacles.columns();
+    }
+
+    static std::uint32_t state(size_t obstacle, size_t dir) {
+        return static_cast<std::uint32_t>(1 + 4 * obstacle + dir);
+    }
+
+    void jump(position& at, size_t level) const {
+        at.steps += m_steps[level][at.state];
+        at.state = m_next[level][at.state];
+    }
+
+    // Walks from (x, y) in direction dir (index into "^>v<") to the next
+    // obstacle: the state of bumping into it, or the exit, and the moves made
+    std::pair<std::uint32_t, std::uint64_t> slide(size_t x, size_t y, size_t dir) const {
+        constexpr auto npos = bitboard::npos;
+        size_t ox = x, oy = y, steps = 0;
+        bool leaves = false;
+        switch (dir) {
+            case 0: {
+                const auto o = m_obstacles_t.prev_in_row(y, x);
+                leaves = o == npos;
+                steps = leaves ? x : x - o - 1;
+                ox = o;
+                break;
+            }
+            case 1: {
+                const auto o = m_obstacles.next_in_row(x, y);
+                leaves = o == columns();
+                steps = o - y - 1;
+                oy = o;
+                break;
+            }
+            case 2: {
+                const auto o = m_obstacles_t.next_in_row(y, x);
+                leaves = o == rows();
+                steps = o - x - 1;
+                ox = o;
+                break;
+            }
+            default: {
+                const auto o = m_obstacles.prev_in_row(x, y);
+                leaves = o == npos;
+                steps = leaves ? y : y - o - 1;
+                oy = o;
+                break;
+            }
+        }
+        if (leaves) {
+            return {exit, steps};
+        }
+        const auto k = std::ranges::lower_bound(m_cells, ox * columns() + oy) - m_cells.begin();
+        return {state(k, dir), steps};
+    }
+
+    bitboard m_obstacles;
+    bitboard m_obstacles_t;
+    // obstacle squares in row-major order, their rank numbers the states
+    std::vector<size_t> m_cells;
+    // m_next[j][s]: the state 2^j turns after s, m_steps[j][s] the moves made
+    std::vector<std::vector<std::uint32_t>> m_next;
+    std::vector<std::vector<std::uint64_t>> m_steps;
+};
+
+// Squares where one new obstacle traps the guard in a loop. Every candidate
+// is an add/remove pair on a per-chunk copy of the solver, so only the walk
+// after the candidate square is simulated again.
+size_t count_loop_obstacles(thread_pool& pool, const guard_solver& base) {
+    auto candidates = base.squares();
+    // the guard starts on the first square
+    candidates.erase(candidates.begin());
+
+    const auto chunks = std::min<size_t>(candidates.size(), pool.size() * 4);
+    return parallel_reduce(pool, 0, chunks, size_t{0},
+        [&](size_t chunk) {
+            auto solver = base;
+            size_t found = 0;
+            for (auto i = chunk; i < candidates.size(); i += chunks) {
+                const auto [x, y] = candidates[i];
+                solver.add_obstacle(x, y);
+                found += solver.loops();
+                solver.remove_obstacle(x, y);
+            }
+            return found;
+        },
+        std::plus<>(), 1);
+}
+
+// Step by step walk over a copy of the map: distinct squares walked and
+// whether the guard came back to a state it was in
+std::pair<size_t, bool> brute_force_walk(const bitboard& obstacles, const point& start) {
+    constexpr int dx[] = {-1, 0, 1, 0};
+    constexpr int dy[] = {0, 1, 0, -1};
+    std::vector<bool> seen(obstacles.rows() * obstacles.columns() * 4);
+    bitboard visited(obstacles.rows(), obstacles.columns());
+    long x = start.x, y = start.y;
+    auto dir = std::string_view("^>v<").find(start.ch);
+    while (true) {
+        visited.set(x, y);
+        const auto state = (x * obstacles.columns() + y) * 4 + dir;
+        if (seen[state]) {
+            return {visited.count(), true};
+        }
+        seen[state] = true;
+        const long nx = x + dx[dir], ny = y + dy[dir];
+        if (nx < 0 || ny < 0 || nx >= long(obstacles.rows()) || ny >= long(obstacles.columns())) {
+            return {visited.count(), false};
+        }
+        if (obstacles.test(nx, ny)) {
+            dir = (dir + 1) % 4;
+        } else {
+            x = nx;
+            y = ny;
+        }
+    }
+}
+
+TEST(GuardSolverTest, EditsMatchBruteForce) {
+    std::mt19937 rng(6);
+    for (int round = 0; round < 200; ++round) {
+        const size_t rows = 1 + rng() % 12, columns = 1 + rng() % 12;
+        const auto density = rng() % 40;
+        bitboard obstacles(rows, columns);
+        for (size_t x = 0; x < rows; ++x)
+            for (size_t y = 0; y < columns; ++y)
+                if (rng() % 100 < density)
+                    obstacles.set(x, y);
+        const point start{rng() % rows, rng() % columns, "^>v<"[rng() % 4]};
+        obstacles.reset(start.x, start.y);
+
+        guard_solver solver(obstacles, start);
+        const auto [visited, loops] = brute_force_walk(obstacles, start);
+        ASSERT_EQ(solver.visited(), visited);
+        ASSERT_EQ(solver.loops(), loops);
+
+        for (int edit = 0; edit < 20; ++edit) {
+            const size_t x = rng() % rows, y = rng() % columns;
+            if (x == start.x && y == start.y)
+                continue;
+            if (obstacles.test(x, y)) {
+                obstacles.reset(x, y);
+                solver.remove_obstacle(x, y);
+            } else {
+                obstacles.set(x, y);
+                solver.add_obstacle(x, y);
+            }
+            const auto [visited, loops] = brute_force_walk(obstacles, start);
+            ASSERT_EQ(solver.visited(), visited) << "round " << round << " edit " << edit;
+            ASSERT_EQ(solver.loops(), loops) << "round " << round << " edit " << edit;
+        }
+    }
+}
+
+TEST(TurnGraphTest, AfterMatchesSingleTurns) {
+    std::mt19937 rng(48);
+    for (int round = 0; round < 100; ++round) {
+        const size_t rows = 1 + rng() % 12, columns = 1 + rng() % 12;
+        bitboard obstacles(rows, columns);
+        for (size_t x = 0; x < rows; ++x)
+            for (size_t y = 0; y < columns; ++y)
+                if (rng() % 100 < 25)
+                    obstacles.set(x, y);
+        const point start{rng() % rows, rng() % columns, "^>v<"[rng() % 4]};
+        obstacles.reset(start.x, start.y);
+
+        const turn_graph graph(obstacles);
+        const auto at = graph.start(start);
+        auto expected = at;
+        for (std::uint64_t turns = 0; turns < 3 * graph.states() + 8; ++turns) {
+            const auto got = graph.after(at, turns);
+            ASSERT_EQ(got.state, expected.state) << "round " << round << " turns " << turns;
+            ASSERT_EQ(got.steps, expected.steps) << "round " << round << " turns " << turns;
+            expected = graph.after(expected, 1);
+        }
+
+        // far past the table, split anywhere
+        constexpr std::uint64_t far = std::uint64_t{1} << 50;
+        const auto whole = graph.after(at, far + 7);
+        const auto split = graph.after(graph.after(at, far), 7);
+        ASSERT_EQ(whole.state, split.state) << "round " << round;
+        ASSERT_EQ(whole.steps, split.steps) << "round " << round;
+    }
+}
+
+TEST(GuardSolverTest, LoopObstaclesMatchBruteForce) {
+    std::mt19937 rng(60);
+    thread_pool pool(2);
+    for (int round = 0; round < 100; ++round) {
+        const size_t rows = 1 + rng() % 10, columns = 1 + rng() % 10;
+        bitboard obstacles(rows, columns);
+        for (size_t x = 0; x < rows; ++x)
+            for (size_t y = 0; y < columns; ++y)
+                if (rng() % 100 < 15)
+                    obstacles.set(x, y);
+        const point start{rng() % rows, rng() % columns, "^>v<"[rng() % 4]};
+        obstacles.reset(start.x, start.y);
+
+        size_t expected = 0;
+        for (size_t x = 0; x < rows; ++x) {
+            for (size_t y = 0; y < columns; ++y) {
+                if (obstacles.test(x, y) || (x == start.x && y == start.y))
+                    continue;
+                auto edited = obstacles;
+                edited.set(x, y);
+                expected += brute_force_walk(edited, start).second;
+            }
+        }
+        ASSERT_EQ(count_loop_obstacles(pool, guard_solver(obstacles, start)), expected) << "round " << round;
+    }
+}
 
 int main(int argc, char* argv[]) {
+    const char* run_tests = std::getenv("RUN_GTEST");
+    if (run_tests != nullptr && std::string(run_tests) != "") {
+        ::testing::InitGoogleTest(&argc, argv);
+        return RUN_ALL_TESTS();
+    }
+
+    const auto opts = parse_options(argc, argv);
+    perf_stats::session perf(opts.perf);
 
-    auto inp = matrix(readinput(argv[1]));
+    alloc_stats::phase parse("parse");
+    arena input_arena(arena::hint(opts.input, 1));
+    auto inp = matrix(readinput(opts.input, input_arena.resource()));
+    parse.stop();
     int column = 4;
     // std::cout << "Input" << std::endl << inp << std::endl;
-    auto output = inp.run();
-    std::cout << "Output: " << output << std::endl;
+    thread_pool pool(opts.threads);
+
+    alloc_stats::phase part1("part1");
+    // a looping walk is cut once it went round the loop
+    const auto walk = turn_graph(inp.obstacles()).walk(inp.start());
+    auto output1 = inp.run(1 + walk.turns);
+    part1.stop();
+
+    alloc_stats::phase part2("part2");
+    auto output2 = count_loop_obstacles(pool, guard_solver(inp.obstacles(), inp.start()));
+    part2.stop();
+
+    std::cout << "Output 1: " << output1 << std::endl;
+    std::cout << "Output 2: " << output2 << std::endl;
+    if (opts.stats) {
+        std::cerr << "Turns: " << walk.turns << std::endl;
+        std::cerr << "Steps: " << walk.steps << std::endl;
+        std::cerr << "Loops: " << (walk.loops ? "yes" : "no") << std::endl;
+    }
     return 0; 
 }
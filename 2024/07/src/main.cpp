@@ -1,37 +1,120 @@
+#include <algorithm>
+#include <atomic>
 #include <bitset>
 #include <charconv>
 #include <cmath>
 #include <cstdint>
+#include <exception>
+#include <filesystem>
+#include <functional>
+#include <initializer_list>
 #include <iostream>
+#include <limits>
 #include <memory>
+#include <memory_resource>
 #include <numeric>
+#include <optional>
 #include <ostream>
 #include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <string_view>
+#include <thread>
 #include <vector>
 #include <sstream>
 #include <fstream>
 #include <cassert>
+#include <random>
 #include <ranges>
 
 #include <gtest/gtest.h>
 
+#ifndef LANE_KERNEL
+#define LANE_KERNEL 0
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS 1
+#else
+#define HAVE_X86_KERNELS 0
+#endif
+
+#include "alloc_stats.hpp"
+#include "arena.hpp"
+#include "options.hpp"
+#include "perf_stats.hpp"
+#include "ring_buffer.hpp"
+#include "snapshot.hpp"
+#include "thread_pool.hpp"
+
 template <typename T>
 concept Streamable = requires(const T &s, std::ostream &os) { os << s; };
 
-struct Line {
-    std::uint64_t header;
-    std::vector<std::uint64_t> numbers;
-};
+// Equations stored column by column: the operands of equation i are
+// operands[offsets[i], offsets[i + 1]), so walking the equations in order
+// reads three arrays front to back.
+struct Equations {
+    std::pmr::vector<std::uint64_t> headers;
+    std::pmr::vector<std::uint64_t> operands;
+    std::pmr::vector<std::uint64_t> offsets;
 
-std::ostream& operator<<(std::ostream& os, const Line& line)
-{
-    os << "Line(" << line.header;
-    for (const auto i : line.numbers) {
-        os << "," << i;
+    explicit Equations(std::pmr::memory_resource* mr = std::pmr::get_default_resource())
+        : headers(mr), operands(mr), offsets(1, 0, mr)
+    {
+    }
+
+    std::size_t size() const { return headers.size(); }
+
+    std::span<const std::uint64_t> operandsOf(std::size_t i) const
+    {
+        return std::span(operands).subspan(offsets[i], offsets[i + 1] - offsets[i]);
+    }
+
+    void reserve(std::size_t equations, std::size_t totalOperands)
+    {
+        headers.reserve(equations);
+        offsets.reserve(equations + 1);
+        operands.reserve(totalOperands);
+    }
+
+    void push_back(std::uint64_t header, std::span<const std::uint64_t> values)
+    {
+        headers.push_back(header);
+        operands.insert(operands.end(), values.begin(), values.end());
+        offsets.push_back(operands.size());
+    }
+
+    void push_back(std::uint64_t header, std::initializer_list<std::uint64_t> values)
+    {
+        push_back(header, std::span(values.begin(), values.size()));
     }
-    os << ")";
-    return os;
-}
+
+    // Drops the equations but keeps the memory for the next ones
+    void clear()
+    {
+        headers.clear();
+        operands.clear();
+        offsets.assign(1, 0);
+    }
+
+    // Longest equations first, so the expensive ones are handed out to the
+    // workers early and the cheap ones fill the gaps at the end
+    void sortByOperandCount()
+    {
+        std::vector<std::uint32_t> order(size());
+        std::iota(order.begin(), order.end(), 0);
+        std::ranges::stable_sort(order, std::greater<>(),
+                                 [this](auto i) { return offsets[i + 1] - offsets[i]; });
+
+        Equations sorted(headers.get_allocator().resource());
+        sorted.reserve(size(), operands.size());
+        for (auto i : order) {
+            sorted.push_back(headers[i], operandsOf(i));
+        }
+        *this = std::move(sorted);
+    }
+};
 
 template <Streamable T>
 std::ostream& operator<<(std::ostream& os, const std::vector<T>& vec)
@@ -91,9 +174,28 @@ TEST(BasicTests, To)
     ASSERT_EQ(intFromStr("0"), 0);
 }
 
-auto concat(auto n1, auto n2) -> decltype(auto)
+// Smallest power of 10 greater than n, the shift that concat applies
+constexpr std::uint64_t pow10Above(std::uint64_t n)
 {
-    return intFromStr(std::format("{}{}", n1, n2));
+    std::uint64_t p = 10;
+    while (p <= n && p <= std::numeric_limits<std::uint64_t>::max() / 10) {
+        p *= 10;
+    }
+    return p;
+}
+
+TEST(BasicTests, Pow10Above)
+{
+    ASSERT_EQ(pow10Above(0), 10);
+    ASSERT_EQ(pow10Above(9), 10);
+    ASSERT_EQ(pow10Above(10), 100);
+    ASSERT_EQ(pow10Above(12345), 100000);
+}
+
+constexpr std::uint64_t concat(auto n1, auto n2)
+{
+    const std::uint64_t v = n2;
+    return n1 * pow10Above(v) + v;
 }
 
 constexpr auto concat(auto n1) { return n1; } 
@@ -127,72 +229,938 @@ TEST(BasicTests, isIn)
     ASSERT_EQ(isIn(4, v), false);
 }
 
-constexpr bool compute(std::uint64_t header, std::uint64_t acc, std::span<const std::uint64_t> rest, std::uint64_t& output)
+// Operator policies. apply() combines the accumulator with the next
+// operand, evaluating left to right, and returns nullopt when the result
+// doesn't fit in 64 bits. invert() undoes it from the right: it returns the
+// accumulator that apply() needs to produce `target` from `v`, or nullopt
+// when there is none, which prunes that branch. invert() is optional.
+// Operands are positive, as in the puzzle input, so no operator ever makes
+// the accumulator smaller.
+template <typename Op>
+concept OperatorPolicy = requires(std::uint64_t acc, std::uint64_t v) {
+    { Op::apply(acc, v) } -> std::same_as<std::optional<std::uint64_t>>;
+};
+
+template <typename Op>
+concept InvertibleOperator = OperatorPolicy<Op> && requires(std::uint64_t target, std::uint64_t v) {
+    { Op::invert(target, v) } -> std::same_as<std::optional<std::uint64_t>>;
+};
+
+struct Add {
+    static constexpr std::optional<std::uint64_t> apply(std::uint64_t acc, std::uint64_t v)
+    {
+        std::uint64_t r;
+        if (__builtin_add_overflow(acc, v, &r)) {
+            return std::nullopt;
+        }
+        return r;
+    }
+
+    static constexpr std::optional<std::uint64_t> invert(std::uint64_t target, std::uint64_t v)
+    {
+        if (target < v) {
+            return std::nullopt;
+        }
+        return target - v;
+    }
+};
+
+struct Mul {
+    static constexpr std::optional<std::uint64_t> apply(std::uint64_t acc, std::uint64_t v)
+    {
+        std::uint64_t r;
+        if (__builtin_mul_overflow(acc, v, &r)) {
+            return std::nullopt;
+        }
+        return r;
+    }
+
+    static constexpr std::optional<std::uint64_t> invert(std::uint64_t target, std::uint64_t v)
+    {
+        if (v == 0 || target % v != 0) {
+            return std::nullopt;
+        }
+        return target / v;
+    }
+};
+
+struct Concat {
+    static constexpr std::optional<std::uint64_t> apply(std::uint64_t acc, std::uint64_t v)
+    {
+        std::uint64_t r;
+        if (v >= 10'000'000'000'000'000'000u
+            || __builtin_mul_overflow(acc, pow10Above(v), &r)
+            || __builtin_add_overflow(r, v, &r)) {
+            return std::nullopt;
+        }
+        return r;
+    }
+
+    // target must end with the digits of v
+    static constexpr std::optional<std::uint64_t> invert(std::uint64_t target, std::uint64_t v)
+    {
+        const auto p = pow10Above(v);
+        if (target % p != v) {
+            return std::nullopt;
+        }
+        return target / p;
+    }
+};
+
+TEST(BasicTests, Invert)
+{
+    ASSERT_EQ(Add::invert(10, 3), 7);
+    ASSERT_EQ(Add::invert(3, 10), std::nullopt);
+    ASSERT_EQ(Mul::invert(12, 3), 4);
+    ASSERT_EQ(Mul::invert(10, 3), std::nullopt);
+    ASSERT_EQ(Concat::invert(156, 6), 15);
+    ASSERT_EQ(Concat::invert(156, 56), 1);
+    ASSERT_EQ(Concat::invert(156, 7), std::nullopt);
+    ASSERT_EQ(Concat::invert(*Concat::apply(12, 345), 345), 12);
+}
+
+TEST(BasicTests, ApplyOverflow)
+{
+    constexpr auto max = std::numeric_limits<std::uint64_t>::max();
+    ASSERT_EQ(Add::apply(max, 0), max);
+    ASSERT_EQ(Add::apply(max, 1), std::nullopt);
+    ASSERT_EQ(Mul::apply(1ull << 32, 1ull << 31), 1ull << 63);
+    ASSERT_EQ(Mul::apply(1ull << 32, 1ull << 32), std::nullopt);
+    ASSERT_EQ(Concat::apply(1844674407370955161, 5), max);
+    ASSERT_EQ(Concat::apply(1844674407370955161, 6), std::nullopt);
+    ASSERT_EQ(Concat::apply(0, max), std::nullopt);
+}
+
+// Optional counters filled in by the solvers
+struct SolveStats {
+    std::uint64_t nodes = 0;
+};
+
+// Walks backwards from the target, undoing the last operand with each
+// operator's invert(), so most branches die after a single remainder or
+// comparison check. The fold over Ops is expanded at compile time, giving
+// every operator set its own recursion.
+template <InvertibleOperator... Ops>
+constexpr bool solvableBackward(std::uint64_t target, std::span<const std::uint64_t> numbers,
+                                SolveStats* stats = nullptr)
+{
+    assert(!numbers.empty());
+    if (stats) {
+        ++stats->nodes;
+    }
+    const auto v = numbers.back();
+    if (numbers.size() == 1) {
+        return target == v;
+    }
+
+    const auto rest = numbers.first(numbers.size() - 1);
+    const auto through = [&]<typename Op>() {
+        const auto acc = Op::invert(target, v);
+        return acc && solvableBackward<Ops...>(*acc, rest, stats);
+    };
+    return (through.template operator()<Ops>() || ...);
+}
+
+// Folds the operands left to right from `acc`. No operator decreases the
+// accumulator, so a branch is dropped as soon as it passes the target,
+// including when apply() overflows.
+template <OperatorPolicy... Ops>
+constexpr bool solvableForward(std::uint64_t target, std::uint64_t acc,
+                               std::span<const std::uint64_t> rest, SolveStats* stats = nullptr)
 {
-    // std::cout << "Computing " << acc << " " << rest << std::endl;
+    if (stats) {
+        ++stats->nodes;
+    }
+    if (acc > target) {
+        return false;
+    }
     if (rest.empty()) {
-        if (acc == header) {
-            output += acc;
-            // found, skip next
-            return true;
+        return acc == target;
+    }
+
+    const auto v = rest.front();
+    const auto tail = rest.subspan(1);
+    const auto through = [&]<typename Op>() {
+        const auto next = Op::apply(acc, v);
+        return next && solvableForward<Ops...>(target, *next, tail, stats);
+    };
+    return (through.template operator()<Ops>() || ...);
+}
+
+// Every accumulator the operands can be folded into without passing
+// `limit`, sorted and without duplicates. Deduplicating after each operand
+// keeps the levels small when operators collide (1 + 1 == 1 * 2).
+template <OperatorPolicy... Ops>
+std::vector<std::uint64_t> reachable(std::uint64_t limit, std::span<const std::uint64_t> numbers,
+                                     SolveStats* stats = nullptr)
+{
+    assert(!numbers.empty());
+    std::vector<std::uint64_t> level, next;
+    if (numbers.front() <= limit) {
+        level.push_back(numbers.front());
+    }
+    for (const auto v : numbers.subspan(1)) {
+        next.clear();
+        for (const auto acc : level) {
+            const auto push = [&]<typename Op>() {
+                const auto r = Op::apply(acc, v);
+                if (r && *r <= limit) {
+                    next.push_back(*r);
+                }
+            };
+            (push.template operator()<Ops>(), ...);
+        }
+        std::ranges::sort(next);
+        next.erase(std::unique(next.begin(), next.end()), next.end());
+        std::swap(level, next);
+        if (stats) {
+            stats->nodes += level.size();
         }
+    }
+    return level;
+}
+
+// Backward search over the suffix that stops where the prefix ends and
+// looks the remaining target up among the prefix accumulators. Undoing an
+// operand never makes the target bigger, so once it is below the smallest
+// prefix accumulator the branch is dead.
+template <InvertibleOperator... Ops>
+bool meetsPrefix(std::uint64_t target, std::span<const std::uint64_t> suffix,
+                 std::span<const std::uint64_t> prefix, SolveStats* stats = nullptr)
+{
+    if (stats) {
+        ++stats->nodes;
+    }
+    if (prefix.empty() || target < prefix.front()) {
         return false;
     }
+    if (suffix.empty()) {
+        return std::ranges::binary_search(prefix, target);
+    }
+
+    const auto v = suffix.back();
+    const auto rest = suffix.first(suffix.size() - 1);
+    const auto through = [&]<typename Op>() {
+        const auto acc = Op::invert(target, v);
+        return acc && meetsPrefix<Ops...>(*acc, rest, prefix, stats);
+    };
+    return (through.template operator()<Ops>() || ...);
+}
+
+// Splits the operands in half: the accumulators of the first half are
+// enumerated forwards, then the second half is undone backwards from the
+// target until it meets one of them. Both halves are about the square root
+// of the full search, paid for with the memory of the prefix level.
+template <InvertibleOperator... Ops>
+bool solvableMeetInTheMiddle(std::uint64_t target, std::span<const std::uint64_t> numbers,
+                             SolveStats* stats = nullptr)
+{
+    assert(!numbers.empty());
+    const auto split = (numbers.size() + 1) / 2;
+    const auto prefix = reachable<Ops...>(target, numbers.first(split), stats);
+    return meetsPrefix<Ops...>(target, numbers.subspan(split), prefix, stats);
+}
+
+// solvableBackward() that gives up once it visited `budget` nodes,
+// returning nullopt
+template <InvertibleOperator... Ops>
+std::optional<bool> solvableBackwardWithin(std::uint64_t target, std::span<const std::uint64_t> numbers,
+                                           std::uint64_t& budget, SolveStats* stats = nullptr)
+{
+    assert(!numbers.empty());
+    if (budget == 0) {
+        return std::nullopt;
+    }
+    --budget;
+    if (stats) {
+        ++stats->nodes;
+    }
+    const auto v = numbers.back();
+    if (numbers.size() == 1) {
+        return target == v;
+    }
+
+    const auto rest = numbers.first(numbers.size() - 1);
+    std::optional<bool> found = false;
+    const auto through = [&]<typename Op>() {
+        const auto acc = Op::invert(target, v);
+        if (acc) {
+            found = solvableBackwardWithin<Ops...>(*acc, rest, budget, stats);
+        }
+        // stop on a match or when out of budget
+        return found != false;
+    };
+    (through.template operator()<Ops>() || ...);
+    return found;
+}
+
+// Brute force over the (+, *) operator masks, 8 at a time. Every 64-bit
+// lane folds the operands with its own mask, bit k picking * over + for
+// operand k + 1, both results are computed and blended by the mask bit, and
+// the lanes are compared with the target at the end, so the loop has no
+// data dependent branches. Accumulators are clamped to target + 1, and the
+// caller guarantees (target + 1) * v stays below 2^63, which keeps every
+// lane exact and lets signed compares stand in for unsigned ones. Masks
+// past the last one repeat earlier masks, as bits past the operand count
+// are never looked at.
+//
+// solvable() only uses it when configured with -DLANE_KERNEL=1. On lines of
+// 1 to 999, as in the puzzle, the backward search prunes most branches
+// after one remainder check and stays ahead of the brute force at every
+// line length; on lines of 1s, 2s and 3s, where that check rarely fails,
+// the lanes win by about a quarter up to 10 operands.
+struct Lanes {
+    // Longest line, in operands, the lanes are used for
+    static constexpr std::size_t upTo = 10;
+
+    static bool eligible(std::uint64_t target, std::span<const std::uint64_t> numbers)
+    {
+        if (numbers.size() < 2 || numbers.size() > upTo) {
+            return false;
+        }
+        const auto largest = std::ranges::max(numbers);
+        std::uint64_t bound;
+        return std::ranges::min(numbers) > 0 && largest < (1ull << 32)
+            && target < std::numeric_limits<std::int64_t>::max()
+            && !__builtin_mul_overflow(target + 1, largest, &bound)
+            && bound < (1ull << 63);
+    }
+
+#if HAVE_X86_KERNELS
+    static bool supported()
+    {
+        static const bool avx2 = __builtin_cpu_supports("avx2");
+        return avx2;
+    }
+
+    // acc * v for acc < 2^64 and v < 2^32, assuming it fits in 64 bits
+    __attribute__((target("avx2")))
+    static __m256i mul64x32(__m256i acc, __m256i v)
+    {
+        const __m256i lo = _mm256_mul_epu32(acc, v);
+        const __m256i hi = _mm256_mul_epu32(_mm256_srli_epi64(acc, 32), v);
+        return _mm256_add_epi64(lo, _mm256_slli_epi64(hi, 32));
+    }
+
+    __attribute__((target("avx2")))
+    static bool solvable(std::uint64_t target, std::span<const std::uint64_t> numbers, SolveStats* stats = nullptr)
+    {
+        const std::uint64_t masks = 1ull << (numbers.size() - 1);
+        const __m256i goal = _mm256_set1_epi64x(target);
+        const __m256i limit = _mm256_set1_epi64x(target + 1);
+        const __m256i one = _mm256_set1_epi64x(1);
+        const __m256i first = _mm256_set1_epi64x(numbers[0]);
+
+        for (std::uint64_t base = 0; base < masks; base += 8) {
+            const __m256i m0 = _mm256_add_epi64(_mm256_set1_epi64x(base), _mm256_setr_epi64x(0, 1, 2, 3));
+            const __m256i m1 = _mm256_add_epi64(_mm256_set1_epi64x(base), _mm256_setr_epi64x(4, 5, 6, 7));
+            __m256i a0 = first;
+            __m256i a1 = first;
+            for (std::size_t k = 1; k < numbers.size(); ++k) {
+                const __m256i v = _mm256_set1_epi64x(numbers[k]);
+                const __m128i shift = _mm_cvtsi64_si128(k - 1);
+                const __m256i mul0 = _mm256_cmpeq_epi64(_mm256_and_si256(_mm256_srl_epi64(m0, shift), one), one);
+                const __m256i mul1 = _mm256_cmpeq_epi64(_mm256_and_si256(_mm256_srl_epi64(m1, shift), one), one);
+                a0 = _mm256_blendv_epi8(_mm256_add_epi64(a0, v), mul64x32(a0, v), mul0);
+                a1 = _mm256_blendv_epi8(_mm256_add_epi64(a1, v), mul64x32(a1, v), mul1);
+                a0 = _mm256_blendv_epi8(limit, a0, _mm256_cmpgt_epi64(limit, a0));
+                a1 = _mm256_blendv_epi8(limit, a1, _mm256_cmpgt_epi64(limit, a1));
+            }
+            if (stats) {
+                stats->nodes += 8;
+            }
+            const __m256i hit = _mm256_or_si256(_mm256_cmpeq_epi64(a0, goal), _mm256_cmpeq_epi64(a1, goal));
+            if (!_mm256_testz_si256(hit, hit)) {
+                return true;
+            }
+        }
+        return false;
+    }
+#else
+    static bool supported() { return false; }
+
+    static bool solvable(std::uint64_t, std::span<const std::uint64_t>, SolveStats* = nullptr)
+    {
+        return false;
+    }
+#endif
+};
+
+TEST(BasicTests, LanesMatchBackward)
+{
+    if (!Lanes::supported()) {
+        GTEST_SKIP() << "needs AVX2";
+    }
+    std::mt19937_64 rng(3);
+    int checked = 0;
+    for (int round = 0; round < 2000; ++round) {
+        std::vector<std::uint64_t> numbers(2 + rng() % (Lanes::upTo - 1));
+        for (auto& n : numbers) {
+            n = 1 + rng() % (round % 3 == 0 ? 3 : 999);
+        }
+        std::uint64_t target = numbers[0];
+        for (auto v : std::span(numbers).subspan(1)) {
+            const auto next = rng() % 2 ? Add::apply(target, v) : Mul::apply(target, v);
+            target = next.value_or(target);
+        }
+        if (round % 2) {
+            target += rng() % 3;
+        }
+        // products of many large operands don't fit the lanes
+        if (!Lanes::eligible(target, numbers)) {
+            continue;
+        }
+        ASSERT_EQ(Lanes::solvable(target, numbers), (solvableBackward<Add, Mul>(target, numbers)));
+        ++checked;
+    }
+    ASSERT_GT(checked, 1000);
+    // the clamp keeps passed lanes from coming back down
+    ASSERT_FALSE(Lanes::solvable(5, std::vector<std::uint64_t>{3, 4, 1}));
+    ASSERT_TRUE(Lanes::solvable(5, std::vector<std::uint64_t>{1, 4, 1}));
+    ASSERT_FALSE(Lanes::eligible(std::uint64_t{1} << 62, std::vector<std::uint64_t>{2, 3}));
+    ASSERT_FALSE(Lanes::eligible(10, std::vector<std::uint64_t>{0, 3}));
+}
+
+// Lines with at least this many operands first get a backward search
+// limited to backwardBudget nodes and switch to meeting in the middle when
+// it runs out. The backward search usually dies quickly on the remainder
+// checks, but lines of small operands (1 divides everything) defeat it.
+constexpr std::size_t meetInTheMiddleFrom = 16;
+constexpr std::uint64_t backwardBudget = 1 << 16;
+
+// Whether `numbers` can be combined left to right with operators from Ops
+// into `target`. Searches backwards when every operator can be inverted,
+// meeting in the middle on long lines the backward search can't handle.
+template <OperatorPolicy... Ops>
+constexpr bool solvable(std::uint64_t target, std::span<const std::uint64_t> numbers,
+                        SolveStats* stats = nullptr)
+{
+    assert(!numbers.empty());
+    if constexpr (LANE_KERNEL && std::is_same_v<std::tuple<Ops...>, std::tuple<Add, Mul>>) {
+        if (Lanes::supported() && Lanes::eligible(target, numbers)) {
+            return Lanes::solvable(target, numbers, stats);
+        }
+    }
+    if constexpr ((InvertibleOperator<Ops> && ...)) {
+        if (numbers.size() >= meetInTheMiddleFrom) {
+            auto budget = backwardBudget;
+            if (const auto found = solvableBackwardWithin<Ops...>(target, numbers, budget, stats)) {
+                return *found;
+            }
+            return solvableMeetInTheMiddle<Ops...>(target, numbers, stats);
+        }
+        return solvableBackward<Ops...>(target, numbers, stats);
+    } else {
+        return solvableForward<Ops...>(target, numbers.front(), numbers.subspan(1), stats);
+    }
+}
 
-    std::uint64_t v = pop(rest);
-    return compute(header, acc + v, rest, output)
-        || compute(header, acc * v, rest, output)
-        || compute(header, concat(acc, v), rest, output);
+TEST(BasicTests, OperatorSets)
+{
+    const auto numbers = [](std::initializer_list<std::uint64_t> l) { return std::vector(l); };
+    ASSERT_TRUE((solvable<Add, Mul>(190, numbers({10, 19}))));
+    ASSERT_TRUE((solvable<Add, Mul>(3267, numbers({81, 40, 27}))));
+    ASSERT_TRUE((solvable<Add, Mul>(292, numbers({11, 6, 16, 20}))));
+    ASSERT_FALSE((solvable<Add, Mul>(156, numbers({15, 6}))));
+    ASSERT_FALSE((solvable<Add, Mul>(7290, numbers({6, 8, 6, 15}))));
+    ASSERT_TRUE((solvable<Add, Mul, Concat>(156, numbers({15, 6}))));
+    ASSERT_TRUE((solvable<Add, Mul, Concat>(7290, numbers({6, 8, 6, 15}))));
+    ASSERT_TRUE((solvable<Add, Mul, Concat>(192, numbers({17, 8, 14}))));
+    ASSERT_FALSE((solvable<Add, Mul, Concat>(21037, numbers({9, 7, 18, 13}))));
+    ASSERT_TRUE((solvable<Mul>(24, numbers({2, 3, 4}))));
+    ASSERT_FALSE((solvable<Add>(24, numbers({2, 3, 4}))));
 }
 
-void compute(const std::uint64_t header, const std::vector<std::uint64_t>& rest,
-              std::uint64_t& output)
+TEST(BasicTests, ForwardMatchesBackward)
 {
-    assert(rest.size() > 0);
-    auto span = std::span(rest);
-    std::uint64_t top = pop(span);
-    assert(top > 0);
-    compute(header, top, span, output);
+    Equations lines;
+    lines.push_back(190, {10, 19});
+    lines.push_back(3267, {81, 40, 27});
+    lines.push_back(83, {17, 5});
+    lines.push_back(156, {15, 6});
+    lines.push_back(7290, {6, 8, 6, 15});
+    lines.push_back(161011, {16, 10, 13});
+    lines.push_back(192, {17, 8, 14});
+    lines.push_back(21037, {9, 7, 18, 13});
+    lines.push_back(292, {11, 6, 16, 20});
+    for (std::size_t i = 0; i < lines.size(); ++i) {
+        const auto header = lines.headers[i];
+        const auto numbers = lines.operandsOf(i);
+        ASSERT_EQ((solvableForward<Add, Mul, Concat>(header, numbers[0], numbers.subspan(1))),
+                  (solvableBackward<Add, Mul, Concat>(header, numbers)));
+        ASSERT_EQ((solvableForward<Add, Mul>(header, numbers[0], numbers.subspan(1))),
+                  (solvableBackward<Add, Mul>(header, numbers)));
+    }
 }
 
-auto compute(const Line& line, std::uint64_t& output)
+TEST(BasicTests, MeetInTheMiddleMatchesBackward)
 {
-    if (line.numbers.size() == 0) {
-        std::ostringstream lineos;
-        lineos << line;
-        throw std::runtime_error(std::format("Line bug? {}", lineos.str()));
+    std::mt19937_64 rng(7);
+    for (int round = 0; round < 300; ++round) {
+        std::vector<std::uint64_t> numbers(1 + rng() % 18);
+        for (auto& n : numbers) {
+            n = 1 + rng() % 12;
+        }
+        // half of the targets are reachable by construction
+        std::uint64_t target = numbers[0];
+        for (std::size_t i = 1; i < numbers.size(); ++i) {
+            const auto v = numbers[i];
+            const auto r = rng() % 3;
+            const auto next = r == 0 ? Add::apply(target, v) : r == 1 ? Mul::apply(target, v) : Concat::apply(target, v);
+            if (!next) {
+                // keep what fits in 64 bits
+                numbers.resize(i);
+                break;
+            }
+            target = *next;
+        }
+        if (round % 2) {
+            target += rng() % 5;
+        }
+        ASSERT_EQ((solvableMeetInTheMiddle<Add, Mul, Concat>(target, numbers)),
+                  (solvableBackward<Add, Mul, Concat>(target, numbers)));
+        ASSERT_EQ((solvableMeetInTheMiddle<Add, Mul>(target, numbers)),
+                  (solvableBackward<Add, Mul>(target, numbers)));
     }
-    compute(line.header, line.numbers, output);
 }
 
-void computeLine(const Line& line, std::uint64_t& output)
+TEST(BasicTests, BackwardBudget)
 {
-    compute(line, output);
+    // 1 divides and ends every target, so nothing is pruned
+    const auto numbers = std::vector<std::uint64_t>(20, 1);
+    std::uint64_t budget = 1000;
+    ASSERT_EQ((solvableBackwardWithin<Add, Mul, Concat>(1'000'000, numbers, budget)), std::nullopt);
+    ASSERT_EQ(budget, 0);
+    ASSERT_FALSE((solvable<Add, Mul, Concat>(1'000'000, numbers)));
+    ASSERT_TRUE((solvable<Add, Mul, Concat>(20, numbers)));
+
+    budget = 1000;
+    ASSERT_EQ((solvableBackwardWithin<Add, Mul>(190, std::vector<std::uint64_t>{10, 19}, budget)), true);
 }
 
-auto parseLine(const auto& line)
+TEST(BasicTests, ForwardPrunes)
 {
-    Line output;
+    // every branch passes 10 after the second operand, so the tree of
+    // 1 + 3 + 9 + 27 nodes is cut after its first two levels
+    const auto numbers = std::vector<std::uint64_t>{5, 6, 7, 8};
+    SolveStats stats;
+    ASSERT_FALSE((solvableForward<Add, Mul, Concat>(10, 5, std::span(numbers).subspan(1), &stats)));
+    ASSERT_EQ(stats.nodes, 1 + 3);
+}
+
+TEST(BasicTests, ForwardOverflow)
+{
+    // 2^32 * 2^32 wraps to 0 in 64 bits
+    const auto numbers = std::vector<std::uint64_t>{1ull << 32, 1ull << 32};
+    ASSERT_FALSE((solvableForward<Mul>(0, numbers[0], std::span(numbers).subspan(1))));
+}
+
+// Sum of headers. Every header fits in 64 bits but their sum may not.
+using Total = unsigned __int128;
+
+std::string toString(Total n)
+{
+    std::string digits;
+    do {
+        digits.push_back('0' + static_cast<int>(n % 10));
+        n /= 10;
+    } while (n > 0);
+    return {digits.rbegin(), digits.rend()};
+}
+
+TEST(BasicTests, TotalToString)
+{
+    ASSERT_EQ(toString(0), "0");
+    ASSERT_EQ(toString(11387), "11387");
+    ASSERT_EQ(toString(Total{1} << 64), "18446744073709551616");
+}
+
+struct Calibration {
+    Total total = 0;
+    SolveStats stats;
+
+    friend Calibration operator+(Calibration a, const Calibration& b)
+    {
+        a.total += b.total;
+        a.stats.nodes += b.stats.nodes;
+        return a;
+    }
+};
+
+template <OperatorPolicy... Ops>
+void compute(std::uint64_t header, std::span<const std::uint64_t> operands, Calibration& output)
+{
+    if (operands.empty()) {
+        throw std::runtime_error(std::format("Line bug? {}", header));
+    }
+    if (solvable<Ops...>(header, operands, &output.stats)) {
+        output.total += header;
+    }
+}
+
+// Total calibration result of the lines solvable with Ops
+template <OperatorPolicy... Ops>
+Calibration calibrate(thread_pool& pool, const Equations& input)
+{
+    return parallel_reduce(pool, 0, input.size(), Calibration{},
+        [&input](std::size_t i) {
+            Calibration found;
+            compute<Ops...>(input.headers[i], input.operandsOf(i), found);
+            return found;
+        },
+        std::plus<>());
+}
+
+TEST(BasicTests, CalibrateDoesNotWrap)
+{
+    constexpr auto max = std::numeric_limits<std::uint64_t>::max();
+    Equations lines;
+    lines.push_back(max, {max});
+    lines.push_back(max, {max});
+    thread_pool pool;
+    ASSERT_EQ(toString(calibrate<Add>(pool, lines).total), "36893488147419103230");
+}
+
+// Appends the equation on `line` to output
+void parseLine(const auto& line, Equations& output)
+{
+    std::uint64_t header = 0;
     char colon;
     std::istringstream linestream(line);
-    linestream >> output.header >> colon;
+    linestream >> header >> colon;
     for (std::uint64_t num; linestream >> num;) {
-        output.numbers.push_back(num);
+        output.operands.push_back(num);
     }
-    return output;
+    output.headers.push_back(header);
+    output.offsets.push_back(output.operands.size());
+}
+
+TEST(AllocTests, ParseLine)
+{
+    if (!alloc_stats::enabled) {
+        GTEST_SKIP() << "configure with -DALLOC_STATS=1";
+    }
+    const std::string line = "21037: 9 7 18 13";
+    Equations output;
+    output.reserve(1, 4);
+    auto c = alloc_stats::measure([&] { parseLine(line, output); });
+    // only the istringstream buffer, the arrays have room already
+    ASSERT_LE(c.allocations, 1);
+}
+
+TEST(BasicTests, SortByOperandCount)
+{
+    Equations lines;
+    lines.push_back(1, {1});
+    lines.push_back(2, {1, 2, 3});
+    lines.push_back(3, {1, 2});
+    lines.push_back(4, {4, 5, 6});
+    lines.sortByOperandCount();
+    ASSERT_EQ(lines.headers, (std::pmr::vector<std::uint64_t>{2, 4, 3, 1}));
+    ASSERT_EQ(lines.offsets, (std::pmr::vector<std::uint64_t>{0, 3, 6, 8, 9}));
+    ASSERT_EQ(lines.operands, (std::pmr::vector<std::uint64_t>{1, 2, 3, 4, 5, 6, 1, 2, 1}));
 }
 
-auto readinput(const auto& path)
+auto readinput(const auto& path, std::pmr::memory_resource* mr)
 {
     std::ifstream fil(path);
     std::string line;
-    std::vector<Line> output;
+    Equations output(mr);
     while (std::getline(fil, line)) {
-        output.push_back(parseLine(line));
+        parseLine(line, output);
+    }
+    return output;
+}
+
+// Snapshot layout, the Equations arrays as they are. Bump the version when
+// it changes:
+//   0: headers
+//   1: offsets
+//   2: operands
+constexpr std::string_view snapshotTag = "2024/07 v1";
+
+void saveInput(const Equations& input, snapshot_writer& out)
+{
+    out.add(std::span<const std::uint64_t>(input.headers));
+    out.add(std::span<const std::uint64_t>(input.offsets));
+    out.add(std::span<const std::uint64_t>(input.operands));
+}
+
+Equations loadInput(const snapshot& snap, std::pmr::memory_resource* mr = std::pmr::get_default_resource())
+{
+    const auto headers = snap.section<std::uint64_t>(0);
+    const auto offsets = snap.section<std::uint64_t>(1);
+    const auto numbers = snap.section<std::uint64_t>(2);
+    if (offsets.size() != headers.size() + 1 || offsets.front() != 0 || offsets.back() != numbers.size()
+        || !std::ranges::is_sorted(offsets)) {
+        throw snapshot_error("Corrupt 2024/07 snapshot");
     }
+
+    Equations output(mr);
+    output.headers.assign(headers.begin(), headers.end());
+    output.offsets.assign(offsets.begin(), offsets.end());
+    output.operands.assign(numbers.begin(), numbers.end());
     return output;
 }
 
+TEST(SnapshotTests, RoundTrip)
+{
+    Equations input;
+    input.push_back(190, {10, 19});
+    input.push_back(3267, {81, 40, 27});
+    input.push_back(7, {});
+    const auto path = std::filesystem::temp_directory_path() / "aoc2024-07-test.snap";
+    const auto source = snapshot_format::source{42, 1234};
+
+    snapshot_writer out;
+    saveInput(input, out);
+    out.write(path, snapshotTag, source);
+
+    auto snap = snapshot::open(path, snapshotTag, source);
+    ASSERT_TRUE(snap.has_value());
+    auto loaded = loadInput(*snap);
+    ASSERT_EQ(loaded.headers, input.headers);
+    ASSERT_EQ(loaded.offsets, input.offsets);
+    ASSERT_EQ(loaded.operands, input.operands);
+
+    // a different source text or layout version invalidates it
+    ASSERT_FALSE(snapshot::open(path, snapshotTag, {42, 4321}).has_value());
+    ASSERT_FALSE(snapshot::open(path, "2024/07 v0", source).has_value());
+    std::filesystem::remove(path);
+}
+
+TEST(SnapshotTests, CorruptIsReparsed)
+{
+    const auto path = std::filesystem::temp_directory_path() / "aoc2024-07-corrupt.txt";
+    std::ofstream(path) << "190: 10 19\n3267: 81 40 27\n";
+    const auto source = snapshot_format::source::of(mapped_file(path).bytes());
+
+    // right source, but offsets past the operands
+    snapshot_writer out;
+    const std::uint64_t headers[] = {190, 3267};
+    const std::uint64_t offsets[] = {0, 2, 9};
+    const std::uint64_t operands[] = {10, 19};
+    out.add(std::span<const std::uint64_t>(headers));
+    out.add(std::span<const std::uint64_t>(offsets));
+    out.add(std::span<const std::uint64_t>(operands));
+    out.write(snapshot_path(path), snapshotTag, source);
+
+    const auto parse = [](const auto& p) { return readinput(p, std::pmr::get_default_resource()); };
+    const auto load = [](const snapshot& snap) { return loadInput(snap); };
+    const auto input = load_or_parse(path, snapshotTag, parse, saveInput, load);
+    ASSERT_EQ(input.operands.size(), 5);
+
+    // and the snapshot was written again from the text
+    auto snap = snapshot::open(snapshot_path(path), snapshotTag, source);
+    ASSERT_TRUE(snap.has_value());
+    ASSERT_EQ(loadInput(*snap).offsets, input.offsets);
+    std::filesystem::remove(snapshot_path(path));
+    std::filesystem::remove(path);
+}
+
+// Parsing overlapped with solving. A parser thread fills batches of
+// equations and hands them to the pool's threads through a queue; the
+// solvers hand the emptied batches back through another one. Only a fixed
+// number of batches ever exists, so memory doesn't grow with the input and
+// the parser stalls when the solvers fall behind.
+struct Pipeline {
+    static constexpr std::size_t batchSize = 256;
+    static constexpr std::size_t queueSize = 64;
+
+    using Queue = mpmc_queue<Equations, queueSize>;
+
+    // Part 1 and part 2 calibrations of the equations in `path`
+    static std::pair<Calibration, Calibration> calibrate(thread_pool& pool, const std::filesystem::path& path)
+    {
+        std::ifstream fil(path);
+        if (!fil.is_open()) {
+            throw std::filesystem::filesystem_error(
+                "File not found", path, std::make_error_code(std::errc::no_such_file_or_directory));
+        }
+
+        auto full = std::make_unique<Queue>();
+        auto empty = std::make_unique<Queue>();
+        const auto batches = std::min<std::size_t>(queueSize, 2 * pool.size() + 2);
+        for (std::size_t i = 0; i < batches; ++i) {
+            Equations batch;
+            batch.reserve(batchSize, batchSize * 8);
+            empty->try_push(std::move(batch));
+        }
+
+        std::atomic<bool> done = false;
+        std::atomic<bool> abandoned = false;
+        std::exception_ptr parseError;
+        std::vector<std::pair<Calibration, Calibration>> found(pool.size());
+        {
+            std::jthread parser([&] {
+                try {
+                    parse(fil, *full, *empty, abandoned);
+                } catch (...) {
+                    parseError = std::current_exception();
+                }
+                done.store(true, std::memory_order_release);
+            });
+
+            task_group group(pool);
+            for (auto& slot : found) {
+                group.run([&] {
+                    try {
+                        solve(*full, *empty, done, slot);
+                    } catch (...) {
+                        abandoned.store(true, std::memory_order_relaxed);
+                        throw;
+                    }
+                });
+            }
+            group.wait();
+        }
+        if (parseError) {
+            std::rethrow_exception(parseError);
+        }
+
+        std::pair<Calibration, Calibration> output;
+        for (const auto& [part1, part2] : found) {
+            output.first = output.first + part1;
+            output.second = output.second + part2;
+        }
+        return output;
+    }
+
+private:
+    static Equations popOrWait(Queue& queue, const std::atomic<bool>& stop)
+    {
+        while (true) {
+            if (auto value = queue.try_pop()) {
+                return std::move(*value);
+            }
+            if (stop.load(std::memory_order_relaxed)) {
+                throw std::runtime_error("Pipeline abandoned");
+            }
+            std::this_thread::yield();
+        }
+    }
+
+    static void push(Queue& queue, Equations&& batch)
+    {
+        while (!queue.try_push(std::move(batch))) {
+            std::this_thread::yield();
+        }
+    }
+
+    static void parse(std::istream& in, Queue& full, Queue& empty, const std::atomic<bool>& abandoned)
+    {
+        std::string line;
+        auto batch = popOrWait(empty, abandoned);
+        while (std::getline(in, line)) {
+            parseLine(line, batch);
+            if (batch.size() == batchSize) {
+                push(full, std::move(batch));
+                batch = popOrWait(empty, abandoned);
+            }
+        }
+        if (batch.size() > 0) {
+            push(full, std::move(batch));
+        }
+    }
+
+    static void solve(Queue& full, Queue& empty, const std::atomic<bool>& done,
+                      std::pair<Calibration, Calibration>& output)
+    {
+        while (true) {
+            auto batch = full.try_pop();
+            if (!batch) {
+                // the parser pushes its last batch before setting done
+                if (!done.load(std::memory_order_acquire)) {
+                    std::this_thread::yield();
+                    continue;
+                }
+                batch = full.try_pop();
+                if (!batch) {
+                    return;
+                }
+            }
+            for (std::size_t i = 0; i < batch->size(); ++i) {
+                compute<Add, Mul>(batch->headers[i], batch->operandsOf(i), output.first);
+                compute<Add, Mul, Concat>(batch->headers[i], batch->operandsOf(i), output.second);
+            }
+            batch->clear();
+            push(empty, std::move(*batch));
+        }
+    }
+};
+
+TEST(PipelineTests, MpmcQueue)
+{
+    constexpr std::uint64_t perProducer = 100000;
+    mpmc_queue<std::uint64_t, 64> queue;
+    std::atomic<std::uint64_t> sum = 0;
+    std::atomic<std::uint64_t> popped = 0;
+    {
+        std::vector<std::jthread> threads;
+        for (std::uint64_t p = 0; p < 3; ++p) {
+            threads.emplace_back([&queue, p] {
+                for (std::uint64_t i = 0; i < perProducer; ++i) {
+                    auto value = p * perProducer + i;
+                    while (!queue.try_push(std::move(value))) {
+                        std::this_thread::yield();
+                    }
+                }
+            });
+        }
+        for (int c = 0; c < 3; ++c) {
+            threads.emplace_back([&] {
+                while (popped.load() < 3 * perProducer) {
+                    if (auto value = queue.try_pop()) {
+                        sum += *value;
+                        ++popped;
+                    } else {
+                        std::this_thread::yield();
+                    }
+                }
+            });
+        }
+    }
+    const auto n = 3 * perProducer;
+    ASSERT_EQ(popped.load(), n);
+    ASSERT_EQ(sum.load(), n * (n - 1) / 2);
+    ASSERT_FALSE(queue.try_pop().has_value());
+}
+
+TEST(PipelineTests, MatchesCalibrate)
+{
+    const auto path = std::filesystem::temp_directory_path() / "aoc2024-07-pipeline.txt";
+    {
+        std::ofstream out(path);
+        std::mt19937_64 rng(7);
+        for (int i = 0; i < 2000; ++i) {
+            const auto n = 1 + rng() % 6;
+            std::vector<std::uint64_t> numbers(n);
+            for (auto& v : numbers) {
+                v = 1 + rng() % 20;
+            }
+            // about half of them solvable
+            auto target = numbers.front();
+            for (std::size_t j = 1; j < n; ++j) {
+                target = rng() % 2 ? Add::apply(target, numbers[j]).value_or(0) : Mul::apply(target, numbers[j]).value_or(0);
+            }
+            out << target + rng() % 2 << ':';
+            for (auto v : numbers) {
+                out << ' ' << v;
+            }
+            out << '\n';
+        }
+    }
+
+    for (unsigned threads : {1u, 4u}) {
+        thread_pool pool(threads);
+        const auto input = readinput(path, std::pmr::get_default_resource());
+        const auto [part1, part2] = Pipeline::calibrate(pool, path);
+        ASSERT_EQ(part1.total, (calibrate<Add, Mul>(pool, input).total));
+        ASSERT_EQ(part2.total, (calibrate<Add, Mul, Concat>(pool, input).total));
+    }
+    std::filesystem::remove(path);
+}
+
 struct count: public std::ranges::view_interface<count> {
     size_t cnt = 0;
     size_t size;
@@ -220,6 +1188,16 @@ auto collect()
     return std::ranges::to<std::vector>();
 }
 
+void report(const options& opts, const Calibration& output1, const Calibration& output2)
+{
+    std::cout << "Output 1: " << toString(output1.total) << std::endl;
+    std::cout << "Output 2: " << toString(output2.total) << std::endl;
+    if (opts.stats) {
+        std::cerr << "Nodes 1: " << output1.stats.nodes << std::endl;
+        std::cerr << "Nodes 2: " << output2.stats.nodes << std::endl;
+    }
+}
+
 int main(int argc, char* argv[])
 {
     const char* run_tests = std::getenv("RUN_GTEST");
@@ -228,13 +1206,38 @@ int main(int argc, char* argv[])
         return RUN_ALL_TESTS();
     }
 
-    auto input = readinput(argv[1]);
+    const auto opts = parse_options(argc, argv);
+    perf_stats::session perf(opts.perf);
+    thread_pool pool(opts.threads);
+
+    // numbers take 8 bytes for their 2 or 3 digits and separator
+    arena inputArena(arena::hint(opts.input, 4));
+    auto* mr = inputArena.resource();
 
-    std::uint64_t output = 0;
-    for (auto [i, line] : input | enumerate(1) | collect()) {
-        computeLine(line, output);
+    if (opts.pipeline) {
+        alloc_stats::phase pipeline("pipeline");
+        const auto [output1, output2] = Pipeline::calibrate(pool, opts.input);
+        pipeline.stop();
+        report(opts, output1, output2);
+        return 0;
     }
 
-    std::cout << "Output: " << output << std::endl;
+    alloc_stats::phase parse("parse");
+    auto input = opts.snapshot
+        ? load_or_parse(opts.input, snapshotTag, [mr](const auto& path) { return readinput(path, mr); }, saveInput,
+                        [mr](const snapshot& snap) { return loadInput(snap, mr); })
+        : readinput(opts.input, mr);
+    input.sortByOperandCount();
+    parse.stop();
+
+    alloc_stats::phase part1("part1");
+    auto output1 = calibrate<Add, Mul>(pool, input);
+    part1.stop();
+
+    alloc_stats::phase part2("part2");
+    auto output2 = calibrate<Add, Mul, Concat>(pool, input);
+    part2.stop();
+
+    report(opts, output1, output2);
     return 0;
 }
@@ -18,6 +18,10 @@
 
 #include <gtest/gtest.h>
 
+#include "alloc_stats.hpp"
+#include "options.hpp"
+#include "perf_stats.hpp"
+
 
 template <typename T>
 concept Streamable = requires(const T &s, std::ostream &os) { os << s; };
@@ -283,12 +287,26 @@ int main(int argc, char* argv[])
         return RUN_ALL_TESTS();
     }
 
-    auto input = readinput(argv[1]);
+    const auto opts = parse_options(argc, argv);
+    perf_stats::session perf(opts.perf);
+
+    alloc_stats::phase parse("parse");
+    auto input = readinput(opts.input);
+    parse.stop();
+
+    alloc_stats::phase part1("part1");
     auto blocks = diskMapToBlocks(input);
-    auto blocksFiles = diskMapToFiles(input);
     auto unpacked = unpackFreeSpace(blocks);
+    auto output1 = checksum(unpacked);
+    part1.stop();
+
+    alloc_stats::phase part2("part2");
+    auto blocksFiles = diskMapToFiles(input);
     auto unpackedFiles = unpackFreeSpaceFile(blocksFiles);
-    std::cout << "Output: " << checksum(unpacked) << std::endl;
-    std::cout << "Output: " << checksum(fromBlockVec(unpackedFiles)) << std::endl;
+    auto output2 = checksum(fromBlockVec(unpackedFiles));
+    part2.stop();
+
+    std::cout << "Output: " << output1 << std::endl;
+    std::cout << "Output: " << output2 << std::endl;
     return 0;
 }
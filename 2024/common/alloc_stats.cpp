@@ -0,0 +1,107 @@
+// Counting replacements for the global allocation functions, linked in when
+// a day is configured with -DALLOC_STATS=1. See alloc_stats.hpp.
+
+#include "alloc_stats.hpp"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace {
+
+std::atomic<std::size_t> g_allocations{0};
+std::atomic<std::size_t> g_bytes{0};
+std::atomic<std::size_t> g_live{0};
+std::atomic<std::size_t> g_peak{0};
+
+// Every block is prefixed with its requested size, the prefix is padded to
+// keep the returned pointer aligned
+constexpr std::size_t header_size(std::size_t align) noexcept
+{
+    return align > alignof(std::max_align_t) ? align : alignof(std::max_align_t);
+}
+
+void* allocate(std::size_t size, std::size_t align) noexcept
+{
+    const auto header = header_size(align);
+    void* base = align > alignof(std::max_align_t)
+        ? std::aligned_alloc(align, (size + header + align - 1) / align * align)
+        : std::malloc(size + header);
+    if (base == nullptr) {
+        return nullptr;
+    }
+
+    auto* p = static_cast<char*>(base) + header;
+    reinterpret_cast<std::size_t*>(p)[-1] = size;
+
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    g_bytes.fetch_add(size, std::memory_order_relaxed);
+    const auto live = g_live.fetch_add(size, std::memory_order_relaxed) + size;
+    auto peak = g_peak.load(std::memory_order_relaxed);
+    while (live > peak && !g_peak.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {
+    }
+    return p;
+}
+
+void deallocate(void* p, std::size_t align) noexcept
+{
+    if (p == nullptr) {
+        return;
+    }
+    auto size = reinterpret_cast<std::size_t*>(p)[-1];
+    g_live.fetch_sub(size, std::memory_order_relaxed);
+    std::free(static_cast<char*>(p) - header_size(align));
+}
+
+void* allocate_or_throw(std::size_t size, std::size_t align)
+{
+    if (auto* p = allocate(size, align)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+constexpr auto default_align = alignof(std::max_align_t);
+
+} // namespace
+
+namespace alloc_stats {
+
+counters snapshot() noexcept
+{
+    return counters{
+        g_allocations.load(std::memory_order_relaxed),
+        g_bytes.load(std::memory_order_relaxed),
+        g_live.load(std::memory_order_relaxed),
+        g_peak.load(std::memory_order_relaxed),
+    };
+}
+
+void reset_peak() noexcept
+{
+    g_peak.store(g_live.load(std::memory_order_relaxed), std::memory_order_relaxed);
+}
+
+} // namespace alloc_stats
+
+void* operator new(std::size_t size) { return allocate_or_throw(size, default_align); }
+void* operator new[](std::size_t size) { return allocate_or_throw(size, default_align); }
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept { return allocate(size, default_align); }
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept { return allocate(size, default_align); }
+void* operator new(std::size_t size, std::align_val_t al) { return allocate_or_throw(size, std::size_t(al)); }
+void* operator new[](std::size_t size, std::align_val_t al) { return allocate_or_throw(size, std::size_t(al)); }
+void* operator new(std::size_t size, std::align_val_t al, const std::nothrow_t&) noexcept { return allocate(size, std::size_t(al)); }
+void* operator new[](std::size_t size, std::align_val_t al, const std::nothrow_t&) noexcept { return allocate(size, std::size_t(al)); }
+
+void operator delete(void* p) noexcept { deallocate(p, default_align); }
+void operator delete[](void* p) noexcept { deallocate(p, default_align); }
+void operator delete(void* p, std::size_t) noexcept { deallocate(p, default_align); }
+void operator delete[](void* p, std::size_t) noexcept { deallocate(p, default_align); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { deallocate(p, default_align); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { deallocate(p, default_align); }
+void operator delete(void* p, std::align_val_t al) noexcept { deallocate(p, std::size_t(al)); }
+void operator delete[](void* p, std::align_val_t al) noexcept { deallocate(p, std::size_t(al)); }
+void operator delete(void* p, std::size_t, std::align_val_t al) noexcept { deallocate(p, std::size_t(al)); }
+void operator delete[](void* p, std::size_t, std::align_val_t al) noexcept { deallocate(p, std::size_t(al)); }
+void operator delete(void* p, std::align_val_t al, const std::nothrow_t&) noexcept { deallocate(p, std::size_t(al)); }
+void operator delete[](void* p, std::align_val_t al, const std::nothrow_t&) noexcept { deallocate(p, std::size_t(al)); }
@@ -0,0 +1,111 @@
+#pragma once
+
+// Opt-in heap instrumentation shared by all days.
+//
+// Configuring a day with -DALLOC_STATS=1 links alloc_stats.cpp into its
+// target, which replaces the global operator new/delete with versions that
+// count allocations, requested bytes and live bytes. With ALLOC_STATS=0
+// (the default) nothing is replaced and the phase scopes below do nothing.
+
+#include <cstddef>
+#include <iostream>
+#include <string_view>
+
+#include "perf_stats.hpp"
+
+#ifndef ALLOC_STATS
+#define ALLOC_STATS 0
+#endif
+
+namespace alloc_stats {
+
+inline constexpr bool enabled = ALLOC_STATS != 0;
+
+struct counters {
+    std::size_t allocations = 0;
+    std::size_t bytes = 0;
+    std::size_t live = 0;
+    std::size_t peak = 0;
+};
+
+#if ALLOC_STATS
+// Totals since program start
+counters snapshot() noexcept;
+// Restart peak tracking from the current live bytes
+void reset_peak() noexcept;
+#else
+inline counters snapshot() noexcept { return {}; }
+inline void reset_peak() noexcept {}
+#endif
+
+// Allocations made since `start`; `peak` is the highest live byte count
+// reached since the last reset_peak()
+inline counters since(const counters& start) noexcept
+{
+    auto now = snapshot();
+    return counters{
+        now.allocations - start.allocations,
+        now.bytes - start.bytes,
+        now.live,
+        now.peak,
+    };
+}
+
+// Runs f() and returns the allocations it made
+template <typename F>
+counters measure(F&& f)
+{
+    reset_peak();
+    auto start = snapshot();
+    f();
+    return since(start);
+}
+
+inline std::ostream& operator<<(std::ostream& os, const counters& c)
+{
+    os << c.allocations << " allocations, " << c.bytes << " bytes, peak "
+       << c.peak << " bytes live";
+    return os;
+}
+
+// RAII scope around a solve phase (parse, part1, part2...). Prints the
+// allocations made inside it to stderr when stopped or destroyed, and
+// records its time and hardware counters when a perf_stats::session is
+// collecting. Phases share the peak tracker, so they must not be nested.
+class phase {
+public:
+    explicit phase(std::string_view name) : m_name(name), m_perf(name)
+    {
+        reset_peak();
+        m_start = snapshot();
+    }
+
+    ~phase()
+    {
+        if (!m_stopped) {
+            stop();
+        }
+    }
+
+    phase(const phase&) = delete;
+    phase& operator=(const phase&) = delete;
+
+    counters stop()
+    {
+        m_perf.stop();
+        m_stopped = true;
+        auto c = since(m_start);
+        if constexpr (enabled) {
+            std::cerr << "[alloc] " << m_name << ": " << c << std::endl;
+        }
+        return c;
+    }
+
+private:
+    std::string_view m_name;
+    perf_stats::scope m_perf;
+    counters m_start;
+    bool m_stopped = false;
+};
+
+} // namespace alloc_stats
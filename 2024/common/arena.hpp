@@ -0,0 +1,41 @@
+#pragma once
+
+// Memory for a day's parsed input.
+//
+// Parsed inputs are built once and all die together at exit, so they are
+// kept in std::pmr containers allocating from a monotonic buffer: every
+// allocation is a pointer bump, deallocating a single object does nothing
+// and the blocks are released together when the arena goes away. Nested
+// pmr containers pass the arena on to their elements.
+//
+// Containers allocated from an arena must not outlive it.
+
+#include <algorithm>
+#include <cstddef>
+#include <filesystem>
+#include <memory_resource>
+#include <system_error>
+
+class arena {
+public:
+    // `initial` is the size of the first block, later blocks grow
+    // geometrically
+    explicit arena(std::size_t initial = 64 * 1024) : m_resource(initial) {}
+
+    // First block sized for an input file that parses into about
+    // `ratio` bytes per byte of text
+    static std::size_t hint(const std::filesystem::path& input, std::size_t ratio)
+    {
+        std::error_code ec;
+        const auto size = std::filesystem::file_size(input, ec);
+        return ec ? 64 * 1024 : std::max<std::size_t>(size * ratio, 4096);
+    }
+
+    arena(const arena&) = delete;
+    arena& operator=(const arena&) = delete;
+
+    std::pmr::memory_resource* resource() { return &m_resource; }
+
+private:
+    std::pmr::monotonic_buffer_resource m_resource;
+};
@@ -0,0 +1,159 @@
+#pragma once
+
+// One bit per grid cell, stored row by row as 64-bit words. A grid with a
+// handful of cell kinds (obstacle, visited, antinode...) is represented as
+// one bitboard per kind, which is 8 times smaller than a char per cell and
+// lets counting and combining planes work on whole words.
+//
+// Bits past the last column of a row are always zero.
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+class bitboard {
+public:
+    using word = std::uint64_t;
+    static constexpr std::size_t word_bits = 64;
+    static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
+    bitboard() = default;
+
+    bitboard(std::size_t rows, std::size_t columns)
+        : m_rows(rows), m_columns(columns), m_stride((columns + word_bits - 1) / word_bits),
+          m_words(rows * m_stride, 0)
+    {
+    }
+
+    std::size_t rows() const { return m_rows; }
+    std::size_t columns() const { return m_columns; }
+
+    bool test(std::size_t r, std::size_t c) const
+    {
+        assert(r < m_rows && c < m_columns);
+        return (m_words[r * m_stride + c / word_bits] >> (c % word_bits)) & 1;
+    }
+
+    void set(std::size_t r, std::size_t c)
+    {
+        assert(r < m_rows && c < m_columns);
+        m_words[r * m_stride + c / word_bits] |= word{1} << (c % word_bits);
+    }
+
+    void reset(std::size_t r, std::size_t c)
+    {
+        assert(r < m_rows && c < m_columns);
+        m_words[r * m_stride + c / word_bits] &= ~(word{1} << (c % word_bits));
+    }
+
+    // Sets columns [first, last) of row r
+    void set_range(std::size_t r, std::size_t first, std::size_t last)
+    {
+        assert(r < m_rows && first <= last && last <= m_columns);
+        auto* row = &m_words[r * m_stride];
+        while (first < last) {
+            const auto bit = first % word_bits;
+            const auto n = std::min(word_bits - bit, last - first);
+            const word mask = n == word_bits ? ~word{0} : ((word{1} << n) - 1) << bit;
+            row[first / word_bits] |= mask;
+            first += n;
+        }
+    }
+
+    // First set column >= c in row r, or columns() if there is none
+    std::size_t next_in_row(std::size_t r, std::size_t c) const
+    {
+        assert(r < m_rows);
+        if (c >= m_columns) {
+            return m_columns;
+        }
+        const auto* row = &m_words[r * m_stride];
+        auto i = c / word_bits;
+        word w = row[i] & (~word{0} << (c % word_bits));
+        while (w == 0) {
+            if (++i == m_stride) {
+                return m_columns;
+            }
+            w = row[i];
+        }
+        return i * word_bits + std::countr_zero(w);
+    }
+
+    // Last set column <= c in row r, or npos if there is none
+    std::size_t prev_in_row(std::size_t r, std::size_t c) const
+    {
+        assert(r < m_rows);
+        if (m_columns == 0) {
+            return npos;
+        }
+        c = std::min(c, m_columns - 1);
+        const auto* row = &m_words[r * m_stride];
+        auto i = c / word_bits;
+        const auto keep = c % word_bits;
+        word w = row[i] & (keep == word_bits - 1 ? ~word{0} : (word{1} << (keep + 1)) - 1);
+        while (w == 0) {
+            if (i-- == 0) {
+                return npos;
+            }
+            w = row[i];
+        }
+        return i * word_bits + (word_bits - 1 - std::countl_zero(w));
+    }
+
+    std::size_t count() const
+    {
+        std::size_t n = 0;
+        for (auto w : m_words) {
+            n += std::popcount(w);
+        }
+        return n;
+    }
+
+    void clear() { std::ranges::fill(m_words, 0); }
+
+    bitboard& operator|=(const bitboard& other)
+    {
+        assert(same_shape(other));
+        for (std::size_t i = 0; i < m_words.size(); ++i) {
+            m_words[i] |= other.m_words[i];
+        }
+        return *this;
+    }
+
+    bitboard& operator&=(const bitboard& other)
+    {
+        assert(same_shape(other));
+        for (std::size_t i = 0; i < m_words.size(); ++i) {
+            m_words[i] &= other.m_words[i];
+        }
+        return *this;
+    }
+
+    friend bitboard operator|(bitboard a, const bitboard& b) { return a |= b; }
+    friend bitboard operator&(bitboard a, const bitboard& b) { return a &= b; }
+
+    std::span<const word> row(std::size_t r) const
+    {
+        assert(r < m_rows);
+        return {m_words.data() + r * m_stride, m_stride};
+    }
+
+    std::span<const word> words() const { return m_words; }
+
+    friend bool operator==(const bitboard&, const bitboard&) = default;
+
+private:
+    bool same_shape(const bitboard& other) const
+    {
+        return m_rows == other.m_rows && m_columns == other.m_columns;
+    }
+
+    std::size_t m_rows = 0;
+    std::size_t m_columns = 0;
+    std::size_t m_stride = 0;
+    std::vector<word> m_words;
+};
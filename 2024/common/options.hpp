@@ -0,0 +1,94 @@
+#pragma once
+
+// Command line shared by all days:
+//
+//   Aoc2024 <input> [--threads N] [--stats] [--snapshot] [--pipeline] [--perf[=json]]
+//
+// --threads 0 uses one thread per hardware thread. --stats asks the day to
+// print its solver counters to stderr. --snapshot lets days that support it
+// load the parsed input from <input>.snap, writing it on the first run.
+// --pipeline lets days that support it solve while the input is still being
+// parsed instead of parsing it all first. --perf prints the time and
+// hardware counters of every phase to stderr as a table, --perf=json as JSON.
+// A bad command line prints the problem and the usage to stderr and exits
+// with status 2.
+
+#include <charconv>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+
+inline constexpr std::string_view usage =
+    "Usage: Aoc2024 <input> [--threads N] [--stats] [--snapshot] [--pipeline] [--perf[=json]]";
+
+enum class perf_format { off, table, json };
+
+struct options {
+    std::filesystem::path input;
+    unsigned threads = 1;
+    bool stats = false;
+    bool snapshot = false;
+    bool pipeline = false;
+    perf_format perf = perf_format::off;
+};
+
+inline unsigned parse_unsigned(std::string_view option, std::string_view value)
+{
+    unsigned n{};
+    auto [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), n);
+    if (ec != std::errc{} || ptr != value.data() + value.size()) {
+        throw std::invalid_argument(std::string(option) + " expects a number, got " + std::string(value));
+    }
+    return n;
+}
+
+// Throws std::invalid_argument on a bad command line
+inline options read_options(int argc, char* argv[])
+{
+    options opts;
+    for (int i = 1; i < argc; ++i) {
+        const std::string_view arg = argv[i];
+        if (arg == "--threads") {
+            if (++i == argc) {
+                throw std::invalid_argument("--threads expects a number");
+            }
+            opts.threads = parse_unsigned(arg, argv[i]);
+            if (opts.threads == 0) {
+                opts.threads = std::max(1u, std::thread::hardware_concurrency());
+            }
+        } else if (arg == "--stats") {
+            opts.stats = true;
+        } else if (arg == "--snapshot") {
+            opts.snapshot = true;
+        } else if (arg == "--pipeline") {
+            opts.pipeline = true;
+        } else if (arg == "--perf" || arg == "--perf=table") {
+            opts.perf = perf_format::table;
+        } else if (arg == "--perf=json") {
+            opts.perf = perf_format::json;
+        } else if (arg.starts_with("--")) {
+            throw std::invalid_argument("Unknown option " + std::string(arg));
+        } else {
+            opts.input = arg;
+        }
+    }
+
+    if (opts.input.empty()) {
+        throw std::invalid_argument("Missing input file");
+    }
+    return opts;
+}
+
+inline options parse_options(int argc, char* argv[])
+{
+    try {
+        return read_options(argc, argv);
+    } catch (const std::invalid_argument& e) {
+        std::cerr << e.what() << '\n' << usage << std::endl;
+        std::exit(2);
+    }
+}
@@ -0,0 +1,262 @@
+#pragma once
+
+// Per-phase timing and hardware counters shared by all days.
+//
+// A day opens one perf_stats::session at the top of main. When asked to
+// with --perf (a table) or --perf=json, the session opens Linux
+// perf_event_open counters for cycles, instructions, L1 data and last level
+// cache read misses and branch misses, and every alloc_stats::phase records
+// the wall-clock time and counter deltas it spans. The session prints one
+// row per phase to stderr when it goes away.
+//
+// Counters the kernel refuses (no PMU in a VM or container, a strict
+// perf_event_paranoid) are left out, down to wall-clock time only when none
+// opens. Counters are inherited by threads created after them, so a day's
+// thread_pool, built after the session, is counted along with the main
+// thread.
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "options.hpp"
+
+namespace perf_stats {
+
+inline constexpr std::size_t events = 5;
+inline constexpr std::array<std::string_view, events> event_names = {
+    "cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses",
+};
+
+using counts = std::array<std::optional<std::uint64_t>, events>;
+
+// One hardware event of the calling thread and the threads it creates
+// afterwards, counting from construction
+class counter {
+public:
+    counter(std::uint32_t type, std::uint64_t config)
+    {
+#if defined(__linux__)
+        perf_event_attr attr{};
+        attr.size = sizeof attr;
+        attr.type = type;
+        attr.config = config;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.inherit = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        m_fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+#else
+        (void)type;
+        (void)config;
+#endif
+    }
+
+    counter(counter&& other) noexcept : m_fd(std::exchange(other.m_fd, -1)) {}
+    counter& operator=(counter&&) = delete;
+    counter(const counter&) = delete;
+
+    ~counter()
+    {
+#if defined(__linux__)
+        if (m_fd >= 0) {
+            close(m_fd);
+        }
+#endif
+    }
+
+    bool available() const { return m_fd >= 0; }
+
+    // Events so far, scaled up when the kernel had to multiplex the counter
+    std::optional<std::uint64_t> read() const
+    {
+#if defined(__linux__)
+        std::uint64_t values[3];
+        if (m_fd < 0 || ::read(m_fd, values, sizeof values) != sizeof values) {
+            return std::nullopt;
+        }
+        const auto [value, enabled, running] = values;
+        if (running == 0) {
+            return 0;
+        }
+        return running == enabled ? value : static_cast<std::uint64_t>(static_cast<double>(value) * enabled / running);
+#else
+        return std::nullopt;
+#endif
+    }
+
+private:
+    int m_fd = -1;
+};
+
+class session {
+public:
+    struct sample {
+        std::chrono::steady_clock::time_point wall;
+        counts values;
+    };
+
+    explicit session(perf_format format) : m_format(format)
+    {
+        if (m_format == perf_format::off) {
+            return;
+        }
+#if defined(__linux__)
+        constexpr auto cache_miss = [](std::uint64_t cache) {
+            return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        };
+        m_counters.emplace_back(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+        m_counters.emplace_back(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+        m_counters.emplace_back(PERF_TYPE_HW_CACHE, cache_miss(PERF_COUNT_HW_CACHE_L1D));
+        m_counters.emplace_back(PERF_TYPE_HW_CACHE, cache_miss(PERF_COUNT_HW_CACHE_LL));
+        m_counters.emplace_back(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+#endif
+        s_current = this;
+    }
+
+    ~session()
+    {
+        if (m_format == perf_format::off) {
+            return;
+        }
+        s_current = nullptr;
+        m_format == perf_format::json ? print_json(std::cerr) : print_table(std::cerr);
+    }
+
+    session(const session&) = delete;
+    session& operator=(const session&) = delete;
+
+    // The session phases report to, if one is collecting
+    static session* current() { return s_current; }
+
+    sample now() const
+    {
+        sample s{std::chrono::steady_clock::now(), {}};
+        for (std::size_t i = 0; i < m_counters.size(); ++i) {
+            s.values[i] = m_counters[i].read();
+        }
+        return s;
+    }
+
+    void record(std::string_view name, const sample& start, const sample& stop)
+    {
+        row r{std::string(name), std::chrono::duration<double, std::milli>(stop.wall - start.wall).count(), {}};
+        for (std::size_t i = 0; i < events; ++i) {
+            if (start.values[i] && stop.values[i]) {
+                r.values[i] = *stop.values[i] - *start.values[i];
+            }
+        }
+        m_rows.push_back(std::move(r));
+    }
+
+private:
+    struct row {
+        std::string name;
+        double wall_ms;
+        counts values;
+    };
+
+    bool available(std::size_t event) const
+    {
+        return event < m_counters.size() && m_counters[event].available();
+    }
+
+    void print_table(std::ostream& os) const
+    {
+        const auto flags = os.flags();
+        os << std::left << std::setw(16) << "phase" << std::right << std::setw(12) << "wall_ms";
+        for (std::size_t i = 0; i < events; ++i) {
+            if (available(i)) {
+                os << std::setw(16) << event_names[i];
+            }
+        }
+        os << '\n';
+        for (const auto& r : m_rows) {
+            os << std::left << std::setw(16) << r.name << std::right << std::setw(12) << std::fixed
+               << std::setprecision(3) << r.wall_ms;
+            for (std::size_t i = 0; i < events; ++i) {
+                if (available(i)) {
+                    os << std::setw(16);
+                    r.values[i] ? os << *r.values[i] : os << '-';
+                }
+            }
+            os << '\n';
+        }
+        if (!available(0) && !available(1)) {
+            os << "(hardware counters unavailable, wall-clock time only)\n";
+        }
+        os.flags(flags);
+        os << std::flush;
+    }
+
+    void print_json(std::ostream& os) const
+    {
+        const auto flags = os.flags();
+        os << "{\"phases\": [";
+        for (std::size_t p = 0; p < m_rows.size(); ++p) {
+            const auto& r = m_rows[p];
+            os << (p == 0 ? "" : ", ") << "{\"name\": \"" << r.name << "\", \"wall_ms\": " << std::fixed
+               << std::setprecision(3) << r.wall_ms;
+            for (std::size_t i = 0; i < events; ++i) {
+                if (r.values[i]) {
+                    os << ", \"" << event_names[i] << "\": " << *r.values[i];
+                }
+            }
+            os << '}';
+        }
+        os << "]}" << std::endl;
+        os.flags(flags);
+    }
+
+    perf_format m_format;
+    std::vector<counter> m_counters;
+    std::vector<row> m_rows;
+    static inline session* s_current = nullptr;
+};
+
+// Records the time and counters between construction and stop() into the
+// current session; does nothing when there is none
+class scope {
+public:
+    explicit scope(std::string_view name) : m_name(name), m_session(session::current())
+    {
+        if (m_session != nullptr) {
+            m_start = m_session->now();
+        }
+    }
+
+    ~scope() { stop(); }
+
+    scope(const scope&) = delete;
+    scope& operator=(const scope&) = delete;
+
+    void stop()
+    {
+        if (m_session != nullptr) {
+            m_session->record(m_name, m_start, m_session->now());
+            m_session = nullptr;
+        }
+    }
+
+private:
+    std::string_view m_name;
+    session* m_session;
+    session::sample m_start;
+};
+
+} // namespace perf_stats
@@ -0,0 +1,139 @@
+#pragma once
+
+// Bounded lock-free queues.
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <utility>
+
+// Single producer, single consumer ring. Each side caches the other side's
+// index and only reloads it when the ring looks full (or empty), so in the
+// common case a push or pop touches no shared cache line besides the slot.
+template <typename T, std::size_t Capacity>
+class spsc_ring {
+    static_assert(std::has_single_bit(Capacity), "Capacity must be a power of two");
+
+public:
+    // Producer side. Returns false instead of waiting when the ring is full.
+    bool try_push(T value)
+    {
+        const auto head = m_head.load(std::memory_order_relaxed);
+        if (head - m_tail_cache == Capacity) {
+            m_tail_cache = m_tail.load(std::memory_order_acquire);
+            if (head - m_tail_cache == Capacity) {
+                return false;
+            }
+        }
+        m_slots[head & mask] = std::move(value);
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side
+    std::optional<T> try_pop()
+    {
+        const auto tail = m_tail.load(std::memory_order_relaxed);
+        if (tail == m_head_cache) {
+            m_head_cache = m_head.load(std::memory_order_acquire);
+            if (tail == m_head_cache) {
+                return std::nullopt;
+            }
+        }
+        T value = std::move(m_slots[tail & mask]);
+        m_tail.store(tail + 1, std::memory_order_release);
+        return value;
+    }
+
+private:
+    static constexpr std::size_t mask = Capacity - 1;
+    static constexpr std::size_t cache_line = 64;
+
+    // written by the producer
+    alignas(cache_line) std::atomic<std::size_t> m_head{0};
+    std::size_t m_tail_cache = 0;
+    // written by the consumer
+    alignas(cache_line) std::atomic<std::size_t> m_tail{0};
+    std::size_t m_head_cache = 0;
+
+    alignas(cache_line) std::array<T, Capacity> m_slots{};
+};
+
+// Multiple producers, multiple consumers (Vyukov's bounded queue). Every
+// slot carries a sequence number telling whether it is ready to be written
+// for the current lap or read, so producers and consumers only contend on
+// their own index.
+template <typename T, std::size_t Capacity>
+class mpmc_queue {
+    static_assert(std::has_single_bit(Capacity), "Capacity must be a power of two");
+
+public:
+    mpmc_queue()
+    {
+        for (std::size_t i = 0; i < Capacity; ++i) {
+            m_slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    mpmc_queue(const mpmc_queue&) = delete;
+    mpmc_queue& operator=(const mpmc_queue&) = delete;
+
+    // Returns false when the queue is full, leaving `value` untouched
+    bool try_push(T&& value)
+    {
+        auto pos = m_enqueue.load(std::memory_order_relaxed);
+        for (;;) {
+            auto& slot = m_slots[pos & mask];
+            const auto seq = slot.sequence.load(std::memory_order_acquire);
+            const auto diff = static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos);
+            if (diff == 0) {
+                if (m_enqueue.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    slot.value = std::move(value);
+                    slot.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = m_enqueue.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    std::optional<T> try_pop()
+    {
+        auto pos = m_dequeue.load(std::memory_order_relaxed);
+        for (;;) {
+            auto& slot = m_slots[pos & mask];
+            const auto seq = slot.sequence.load(std::memory_order_acquire);
+            const auto diff = static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos + 1);
+            if (diff == 0) {
+                if (m_dequeue.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    T value = std::move(slot.value);
+                    slot.sequence.store(pos + Capacity, std::memory_order_release);
+                    return value;
+                }
+            } else if (diff < 0) {
+                return std::nullopt;
+            } else {
+                pos = m_dequeue.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+private:
+    static constexpr std::size_t mask = Capacity - 1;
+    static constexpr std::size_t cache_line = 64;
+
+    struct slot {
+        std::atomic<std::size_t> sequence;
+        T value;
+    };
+
+    alignas(cache_line) std::atomic<std::size_t> m_enqueue{0};
+    alignas(cache_line) std::atomic<std::size_t> m_dequeue{0};
+    alignas(cache_line) std::array<slot, Capacity> m_slots;
+};
@@ -0,0 +1,317 @@
+#pragma once
+
+// Binary cache of a day's parsed input, stored next to it as <input>.snap.
+//
+// Layout (native endianness, the file is only meant for the machine that
+// wrote it):
+//
+//   header    magic, format version, day tag, section count, size and
+//             FNV-1a hash of the source text
+//   table     offset, element size and element count of every section
+//   sections  contiguous arrays of trivially copyable values, each starting
+//             on an 8 byte boundary
+//
+// Variable length records are stored as an offsets section plus a values
+// section (CSR), so nothing has to be rebuilt record by record. A snapshot
+// is only used when magic, version, tag and source hash all match; the tag
+// carries the day and the version of its layout ("2024/07 v1"). Loading
+// maps the file and hands out spans into the mapping.
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Read-only mapping of a whole file
+class mapped_file {
+public:
+    mapped_file() = default;
+
+    explicit mapped_file(const std::filesystem::path& path)
+    {
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::filesystem::filesystem_error(
+                "File not found", path, std::error_code(errno, std::generic_category()));
+        }
+        struct stat st{};
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) {
+                m_data = static_cast<const std::byte*>(p);
+                m_size = st.st_size;
+            }
+        }
+        ::close(fd);
+        if (m_data == nullptr && st.st_size > 0) {
+            throw std::filesystem::filesystem_error(
+                "Could not map file", path, std::error_code(errno, std::generic_category()));
+        }
+    }
+
+    mapped_file(mapped_file&& other) noexcept
+        : m_data(std::exchange(other.m_data, nullptr)), m_size(std::exchange(other.m_size, 0))
+    {
+    }
+
+    mapped_file& operator=(mapped_file&& other) noexcept
+    {
+        std::swap(m_data, other.m_data);
+        std::swap(m_size, other.m_size);
+        return *this;
+    }
+
+    ~mapped_file()
+    {
+        if (m_data != nullptr) {
+            munmap(const_cast<std::byte*>(m_data), m_size);
+        }
+    }
+
+    std::span<const std::byte> bytes() const { return {m_data, m_size}; }
+
+private:
+    const std::byte* m_data = nullptr;
+    std::size_t m_size = 0;
+};
+
+constexpr std::uint64_t fnv1a(std::span<const std::byte> bytes)
+{
+    std::uint64_t h = 0xcbf29ce484222325;
+    for (auto b : bytes) {
+        h = (h ^ std::to_integer<std::uint64_t>(b)) * 0x100000001b3;
+    }
+    return h;
+}
+
+namespace snapshot_format {
+
+inline constexpr char magic[8] = {'A', 'O', 'C', 'S', 'N', 'A', 'P', '\0'};
+inline constexpr std::uint32_t version = 1;
+inline constexpr std::size_t alignment = 8;
+
+struct header {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t sections;
+    char tag[16];
+    std::uint64_t source_size;
+    std::uint64_t source_hash;
+};
+
+struct section {
+    std::uint64_t offset;
+    std::uint64_t count;
+    std::uint32_t element_size;
+    std::uint32_t reserved;
+};
+
+// Identifies the text a snapshot was made from
+struct source {
+    std::uint64_t size;
+    std::uint64_t hash;
+
+    static source of(std::span<const std::byte> text) { return {text.size(), fnv1a(text)}; }
+};
+
+} // namespace snapshot_format
+
+class snapshot_writer {
+public:
+    template <typename T>
+    void add(std::span<const T> values)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        m_sections.push_back({0, values.size(), sizeof(T), 0});
+        const auto bytes = std::as_bytes(values);
+        m_data.emplace_back(bytes.begin(), bytes.end());
+    }
+
+    template <typename T>
+    void add(const std::vector<T>& values)
+    {
+        add(std::span<const T>(values));
+    }
+
+    // Writes to a temporary file first so a reader never sees half a snapshot
+    void write(const std::filesystem::path& path, std::string_view tag,
+               snapshot_format::source source)
+    {
+        using namespace snapshot_format;
+        header h{};
+        std::memcpy(h.magic, magic, sizeof magic);
+        h.version = version;
+        h.sections = m_sections.size();
+        if (tag.size() >= sizeof h.tag) {
+            throw std::invalid_argument("Snapshot tag too long: " + std::string(tag));
+        }
+        std::ranges::copy(tag, h.tag);
+        h.source_size = source.size;
+        h.source_hash = source.hash;
+
+        auto offset = pad(sizeof h + m_sections.size() * sizeof(section));
+        for (std::size_t i = 0; i < m_sections.size(); ++i) {
+            m_sections[i].offset = offset;
+            offset = pad(offset + m_data[i].size());
+        }
+
+        auto tmp = path;
+        tmp += ".tmp";
+        {
+            std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+            std::uint64_t written = 0;
+            auto put = [&](const void* p, std::size_t n) {
+                out.write(static_cast<const char*>(p), n);
+                written += n;
+            };
+            auto align = [&] {
+                static constexpr char zeros[alignment] = {};
+                put(zeros, pad(written) - written);
+            };
+            put(&h, sizeof h);
+            put(m_sections.data(), m_sections.size() * sizeof(section));
+            for (const auto& data : m_data) {
+                align();
+                put(data.data(), data.size());
+            }
+            if (!out.flush()) {
+                throw std::filesystem::filesystem_error(
+                    "Could not write snapshot", tmp, std::make_error_code(std::errc::io_error));
+            }
+        }
+        std::filesystem::rename(tmp, path);
+    }
+
+private:
+    static std::uint64_t pad(std::uint64_t n)
+    {
+        return (n + snapshot_format::alignment - 1) / snapshot_format::alignment * snapshot_format::alignment;
+    }
+
+    std::vector<snapshot_format::section> m_sections;
+    std::vector<std::vector<std::byte>> m_data;
+};
+
+// Thrown by section() and by a day's load function when the arrays of a
+// snapshot don't fit together; load_or_parse() then treats the snapshot as
+// out of date
+class snapshot_error : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+class snapshot {
+public:
+    // The snapshot at `path` if it exists, is well formed and was made by
+    // `tag` from `source`
+    static std::optional<snapshot> open(const std::filesystem::path& path, std::string_view tag,
+                                        snapshot_format::source source)
+    {
+        using namespace snapshot_format;
+        std::error_code ec;
+        if (!std::filesystem::is_regular_file(path, ec)) {
+            return std::nullopt;
+        }
+        snapshot snap;
+        snap.m_file = mapped_file(path);
+        const auto bytes = snap.m_file.bytes();
+        if (bytes.size() < sizeof(header)) {
+            return std::nullopt;
+        }
+
+        header h;
+        std::memcpy(&h, bytes.data(), sizeof h);
+        if (std::memcmp(h.magic, magic, sizeof magic) != 0 || h.version != version
+            || std::string_view(h.tag, strnlen(h.tag, sizeof h.tag)) != tag
+            || h.source_size != source.size || h.source_hash != source.hash
+            || bytes.size() < sizeof h + std::uint64_t{h.sections} * sizeof(snapshot_format::section)) {
+            return std::nullopt;
+        }
+
+        snap.m_sections.resize(h.sections);
+        std::memcpy(snap.m_sections.data(), bytes.data() + sizeof h, h.sections * sizeof(snapshot_format::section));
+        for (const auto& s : snap.m_sections) {
+            if (s.offset % alignment != 0 || s.offset > bytes.size()
+                || s.element_size == 0 || s.count > (bytes.size() - s.offset) / s.element_size) {
+                return std::nullopt;
+            }
+        }
+        return snap;
+    }
+
+    std::size_t sections() const { return m_sections.size(); }
+
+    // Section i viewed as an array of T, valid as long as the snapshot lives
+    template <typename T>
+    std::span<const T> section(std::size_t i) const
+    {
+        static_assert(std::is_trivially_copyable_v<T> && alignof(T) <= snapshot_format::alignment);
+        if (i >= m_sections.size() || m_sections[i].element_size != sizeof(T)) {
+            throw snapshot_error("Snapshot section " + std::to_string(i) + " has an unexpected type");
+        }
+        const auto& s = m_sections[i];
+        return {reinterpret_cast<const T*>(m_file.bytes().data() + s.offset), s.count};
+    }
+
+private:
+    snapshot() = default;
+
+    mapped_file m_file;
+    std::vector<snapshot_format::section> m_sections;
+};
+
+inline std::filesystem::path snapshot_path(const std::filesystem::path& input)
+{
+    auto path = input;
+    path += ".snap";
+    return path;
+}
+
+// Loads the parsed input from the snapshot next to `input` when it is up to
+// date and load accepts it. Otherwise parses the text and stores a new
+// snapshot; failing to store it is only reported, the parsed input is still
+// returned.
+//
+//   parse(path) -> T
+//   save(const T&, snapshot_writer&)
+//   load(const snapshot&) -> T
+template <typename Parse, typename Save, typename Load>
+auto load_or_parse(const std::filesystem::path& input, std::string_view tag, Parse parse, Save save, Load load)
+{
+    const auto source = snapshot_format::source::of(mapped_file(input).bytes());
+    const auto path = snapshot_path(input);
+    if (auto snap = snapshot::open(path, tag, source)) {
+        try {
+            return load(*snap);
+        } catch (const snapshot_error& e) {
+            std::cerr << "Warning: " << e.what() << ", parsing " << input.string() << " again" << std::endl;
+        }
+    }
+
+    auto parsed = parse(input);
+    try {
+        snapshot_writer out;
+        save(parsed, out);
+        out.write(path, tag, source);
+    } catch (const std::exception& e) {
+        std::cerr << "Warning: " << e.what() << std::endl;
+    }
+    return parsed;
+}
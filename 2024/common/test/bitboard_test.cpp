@@ -0,0 +1,48 @@
+#include <gtest/gtest.h>
+
+#include "bitboard.hpp"
+
+TEST(BitboardTest, SetAndCount) {
+    bitboard b(3, 70);
+    b.set(0, 0);
+    b.set(1, 63);
+    b.set(1, 64);
+    b.set(2, 69);
+    b.set(2, 69);
+    ASSERT_EQ(b.count(), 4);
+    ASSERT_TRUE(b.test(1, 64));
+    ASSERT_FALSE(b.test(1, 65));
+    b.reset(1, 64);
+    ASSERT_EQ(b.count(), 3);
+    b.set_range(0, 10, 70);
+    ASSERT_EQ(b.count(), 3 + 60);
+    b.clear();
+    ASSERT_EQ(b.count(), 0);
+}
+
+TEST(BitboardTest, RowScans) {
+    bitboard b(1, 130);
+    b.set(0, 5);
+    b.set(0, 100);
+    ASSERT_EQ(b.next_in_row(0, 0), 5);
+    ASSERT_EQ(b.next_in_row(0, 5), 5);
+    ASSERT_EQ(b.next_in_row(0, 6), 100);
+    ASSERT_EQ(b.next_in_row(0, 101), 130);
+    ASSERT_EQ(b.prev_in_row(0, 129), 100);
+    ASSERT_EQ(b.prev_in_row(0, 99), 5);
+    ASSERT_EQ(b.prev_in_row(0, 4), bitboard::npos);
+}
+
+TEST(BitboardTest, Combine) {
+    bitboard a(2, 70), b(2, 70);
+    a.set(0, 0);
+    a.set(1, 69);
+    b.set(1, 69);
+    b.set(1, 3);
+    ASSERT_EQ((a | b).count(), 3);
+    ASSERT_EQ((a & b).count(), 1);
+    ASSERT_TRUE((a & b).test(1, 69));
+    a |= b;
+    ASSERT_EQ(a, a | b);
+    ASSERT_EQ(a.row(1).size(), 2);
+}
@@ -0,0 +1,38 @@
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "thread_pool.hpp"
+
+TEST(ThreadPoolTests, ParallelReduce) {
+    for (unsigned threads : {1, 4}) {
+        thread_pool pool(threads);
+        auto sum = parallel_reduce(pool, 0, 10000, std::uint64_t{0},
+                                   [](std::size_t i) { return i; }, std::plus<>());
+        ASSERT_EQ(sum, 49995000);
+    }
+}
+
+TEST(ThreadPoolTests, NestedParallelFor) {
+    thread_pool pool(4);
+    std::vector<std::atomic<int>> hits(64);
+    parallel_for(pool, 0, 8, [&](std::size_t i) {
+        parallel_for(pool, 0, 8, [&](std::size_t j) { hits[i * 8 + j]++; }, 1);
+    }, 1);
+    for (auto& h : hits) {
+        ASSERT_EQ(h.load(), 1);
+    }
+}
+
+TEST(ThreadPoolTests, TaskGroupRethrows) {
+    thread_pool pool(2);
+    task_group group(pool);
+    group.run([] { throw std::runtime_error("boom"); });
+    group.run([] {});
+    ASSERT_THROW(group.wait(), std::runtime_error);
+}
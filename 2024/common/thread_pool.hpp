@@ -0,0 +1,268 @@
+#pragma once
+
+// Small work-stealing thread pool shared by the days.
+//
+// Every participating thread owns a task deque: it pushes and pops its own
+// tasks at the back and steals from the front of the others when it runs
+// dry. Threads waiting on a task_group run pending tasks instead of
+// blocking, so nested parallel loops can't deadlock. The thread that
+// creates the pool takes part in the work through task_group::wait(), so a
+// pool of size 1 starts no threads and runs everything inline.
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+class thread_pool {
+public:
+    using task = std::move_only_function<void()>;
+
+    explicit thread_pool(unsigned threads = 1)
+    {
+        threads = std::max(1u, threads);
+        for (unsigned i = 0; i < threads; ++i) {
+            m_queues.push_back(std::make_unique<queue>());
+        }
+        // queue 0 belongs to the threads outside of the pool
+        for (unsigned i = 1; i < threads; ++i) {
+            m_workers.emplace_back([this, i] { work(i); });
+        }
+    }
+
+    ~thread_pool()
+    {
+        {
+            std::lock_guard lock(m_mutex);
+            m_stop = true;
+        }
+        m_wakeup.notify_all();
+    }
+
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+
+    // Number of threads taking part, counting the waiting caller
+    unsigned size() const { return m_queues.size(); }
+
+    void submit(task t)
+    {
+        {
+            auto& q = *m_queues[current_queue()];
+            std::lock_guard lock(q.mutex);
+            q.tasks.push_back(std::move(t));
+        }
+        m_queued.fetch_add(1, std::memory_order_release);
+        // pairs with the predicate check in work(), so the wakeup can't be
+        // lost between a worker seeing an empty pool and going to sleep
+        { std::lock_guard lock(m_mutex); }
+        m_wakeup.notify_one();
+    }
+
+    // Runs one pending task, own queue first, then stealing. Returns false
+    // when there was nothing to run.
+    bool run_pending()
+    {
+        const auto self = current_queue();
+        auto t = pop(self);
+        for (std::size_t i = 1; !t && i < m_queues.size(); ++i) {
+            t = steal((self + i) % m_queues.size());
+        }
+        if (!t) {
+            return false;
+        }
+        m_queued.fetch_sub(1, std::memory_order_relaxed);
+        (*t)();
+        return true;
+    }
+
+private:
+    struct queue {
+        std::mutex mutex;
+        std::deque<task> tasks;
+    };
+
+    std::size_t current_queue() const
+    {
+        return tl_pool == this ? tl_index : 0;
+    }
+
+    std::optional<task> pop(std::size_t i)
+    {
+        auto& q = *m_queues[i];
+        std::lock_guard lock(q.mutex);
+        if (q.tasks.empty()) {
+            return std::nullopt;
+        }
+        auto t = std::move(q.tasks.back());
+        q.tasks.pop_back();
+        return t;
+    }
+
+    std::optional<task> steal(std::size_t i)
+    {
+        auto& q = *m_queues[i];
+        std::lock_guard lock(q.mutex);
+        if (q.tasks.empty()) {
+            return std::nullopt;
+        }
+        auto t = std::move(q.tasks.front());
+        q.tasks.pop_front();
+        return t;
+    }
+
+    void work(std::size_t index)
+    {
+        tl_pool = this;
+        tl_index = index;
+        while (true) {
+            if (run_pending()) {
+                continue;
+            }
+            std::unique_lock lock(m_mutex);
+            m_wakeup.wait(lock, [this] {
+                return m_stop || m_queued.load(std::memory_order_acquire) > 0;
+            });
+            if (m_stop) {
+                return;
+            }
+        }
+    }
+
+    static inline thread_local const thread_pool* tl_pool = nullptr;
+    static inline thread_local std::size_t tl_index = 0;
+
+    std::vector<std::unique_ptr<queue>> m_queues;
+    std::atomic<std::size_t> m_queued{0};
+    std::mutex m_mutex;
+    std::condition_variable m_wakeup;
+    bool m_stop = false;
+    // declared last so the workers are joined before anything else goes away
+    std::vector<std::jthread> m_workers;
+};
+
+// A set of tasks that can be waited on together. The first exception thrown
+// by a task is rethrown from wait().
+class task_group {
+public:
+    explicit task_group(thread_pool& pool) : m_pool(pool) {}
+
+    ~task_group()
+    {
+        while (m_pending.load(std::memory_order_acquire) > 0) {
+            help();
+        }
+    }
+
+    task_group(const task_group&) = delete;
+    task_group& operator=(const task_group&) = delete;
+
+    template <typename F>
+    void run(F&& f)
+    {
+        m_pending.fetch_add(1, std::memory_order_relaxed);
+        m_pool.submit([this, f = std::forward<F>(f)]() mutable {
+            try {
+                f();
+            } catch (...) {
+                std::lock_guard lock(m_error_mutex);
+                if (!m_error) {
+                    m_error = std::current_exception();
+                }
+            }
+            m_pending.fetch_sub(1, std::memory_order_release);
+        });
+    }
+
+    void wait()
+    {
+        while (m_pending.load(std::memory_order_acquire) > 0) {
+            help();
+        }
+        if (m_error) {
+            std::rethrow_exception(std::exchange(m_error, nullptr));
+        }
+    }
+
+private:
+    void help()
+    {
+        if (!m_pool.run_pending()) {
+            std::this_thread::yield();
+        }
+    }
+
+    thread_pool& m_pool;
+    std::atomic<std::size_t> m_pending{0};
+    std::mutex m_error_mutex;
+    std::exception_ptr m_error;
+};
+
+// Chunk size giving every thread a few chunks to balance with
+inline std::size_t default_grain(const thread_pool& pool, std::size_t n)
+{
+    return std::max<std::size_t>(1, n / (pool.size() * 4));
+}
+
+// Calls f(i) for every i in [begin, end)
+template <typename F>
+void parallel_for(thread_pool& pool, std::size_t begin, std::size_t end, F&& f, std::size_t grain = 0)
+{
+    if (begin >= end) {
+        return;
+    }
+    grain = grain > 0 ? grain : default_grain(pool, end - begin);
+
+    task_group group(pool);
+    for (auto lo = begin; lo < end; lo += grain) {
+        const auto hi = std::min(end, lo + grain);
+        group.run([&f, lo, hi] {
+            for (auto i = lo; i < hi; ++i) {
+                f(i);
+            }
+        });
+    }
+    group.wait();
+}
+
+// Folds map(i) for every i in [begin, end) with reduce. Partial results are
+// combined in index order, so a non-commutative reduce is fine as long as it
+// is associative and `init` is its identity.
+template <typename T, typename Map, typename Reduce>
+T parallel_reduce(thread_pool& pool, std::size_t begin, std::size_t end, T init,
+                  Map&& map, Reduce&& reduce, std::size_t grain = 0)
+{
+    if (begin >= end) {
+        return init;
+    }
+    grain = grain > 0 ? grain : default_grain(pool, end - begin);
+
+    std::vector<T> partials((end - begin + grain - 1) / grain, init);
+    task_group group(pool);
+    for (std::size_t chunk = 0; chunk < partials.size(); ++chunk) {
+        group.run([&, chunk] {
+            const auto lo = begin + chunk * grain;
+            const auto hi = std::min(end, lo + grain);
+            T acc = init;
+            for (auto i = lo; i < hi; ++i) {
+                acc = reduce(std::move(acc), map(i));
+            }
+            partials[chunk] = std::move(acc);
+        });
+    }
+    group.wait();
+
+    for (auto& partial : partials) {
+        init = reduce(std::move(init), std::move(partial));
+    }
+    return init;
+}